@@ -0,0 +1,182 @@
+// Localhost load test for the order gateway: opens N connections, sends
+// orders one at a time on each and times the round trip to the reply.
+//
+// Usage: load_test [--plain] [--port N] [--connections N] [--orders N]
+//
+// Orders are non-crossing limit buys, so every reply is a single line and
+// no fills are generated. Only ORDER ACCEPTED counts as a completed order;
+// any other reply is an error and makes the run fail. Start the server with
+// a rate limit above the offered load (--max-orders-per-sec).
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using boost::asio::ip::tcp;
+namespace ssl = boost::asio::ssl;
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+struct ConnectionResult
+{
+    std::vector<double> latenciesUs;   // accepted orders only
+    uint64_t errors = 0;
+    std::string firstError;
+};
+
+// Parse the whole of text as an unsigned number no larger than max
+bool parseNumber(const char* text, unsigned long long max, unsigned long long& out)
+{
+    if (!text || *text < '0' || *text > '9') {
+        return false;
+    }
+    errno = 0;
+    char* end = nullptr;
+    out = std::strtoull(text, &end, 10);
+    return errno == 0 && *end == '\0' && out <= max;
+}
+
+template <typename Stream>
+void runOrders(Stream& stream, int orders, ConnectionResult& result)
+{
+    const std::string msg = "ORDER buy limit 100 1\n";
+    boost::asio::streambuf reply;
+    for (int i = 0; i < orders; ++i)
+    {
+        auto t0 = Clock::now();
+        boost::asio::write(stream, boost::asio::buffer(msg));
+        std::size_t n = boost::asio::read_until(stream, reply, '\n');
+        std::string line(boost::asio::buffers_begin(reply.data()),
+                         boost::asio::buffers_begin(reply.data()) + n);
+        reply.consume(n);
+        double us = std::chrono::duration<double, std::micro>(Clock::now() - t0).count();
+
+        if (line == "ORDER ACCEPTED\n") {
+            result.latenciesUs.push_back(us);
+        } else {
+            if (result.errors++ == 0) {
+                result.firstError = line.substr(0, line.find('\n'));
+            }
+        }
+    }
+}
+
+void runConnection(bool tls, unsigned short port, int orders, ConnectionResult& result)
+{
+    boost::asio::io_context ioc;
+    tcp::endpoint endpoint(boost::asio::ip::make_address("127.0.0.1"), port);
+    if (tls)
+    {
+        ssl::context ctx(ssl::context::tls_client);
+        ctx.set_verify_mode(ssl::verify_none);
+        ssl::stream<tcp::socket> stream(ioc, ctx);
+        stream.next_layer().connect(endpoint);
+        stream.next_layer().set_option(tcp::no_delay(true));
+        stream.handshake(ssl::stream_base::client);
+        runOrders(stream, orders, result);
+    }
+    else
+    {
+        tcp::socket socket(ioc);
+        socket.connect(endpoint);
+        socket.set_option(tcp::no_delay(true));
+        runOrders(socket, orders, result);
+    }
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    bool tls = true;
+    unsigned short port = 12345;
+    int connections = 4;
+    int orders = 10000;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* opt = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        unsigned long long n = 0;
+        bool ok = true;
+
+        if (std::strcmp(opt, "--plain") == 0) {
+            tls = false;
+        } else if (std::strcmp(opt, "--port") == 0) {
+            ok = parseNumber(value, 65535, n) && n > 0;
+            port = static_cast<unsigned short>(n);
+            ++i;
+        } else if (std::strcmp(opt, "--connections") == 0) {
+            ok = parseNumber(value, 1024, n) && n > 0;
+            connections = static_cast<int>(n);
+            ++i;
+        } else if (std::strcmp(opt, "--orders") == 0) {
+            ok = parseNumber(value, 100000000, n) && n > 0;
+            orders = static_cast<int>(n);
+            ++i;
+        } else {
+            std::cerr << "Unknown option: " << opt << std::endl;
+            return 1;
+        }
+
+        if (!ok) {
+            std::cerr << "Invalid value for " << opt << ": " << (value ? value : "(missing)") << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<ConnectionResult> perConnection(connections);
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    for (int c = 0; c < connections; ++c)
+    {
+        threads.emplace_back([&, c]{
+            try {
+                runConnection(tls, port, orders, perConnection[c]);
+            } catch (std::exception& e) {
+                perConnection[c].errors++;
+                perConnection[c].firstError = e.what();
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<double> all;
+    uint64_t errors = 0;
+    for (int c = 0; c < connections; ++c)
+    {
+        auto& r = perConnection[c];
+        all.insert(all.end(), r.latenciesUs.begin(), r.latenciesUs.end());
+        errors += r.errors;
+        if (r.errors > 0) {
+            std::cerr << "Connection " << c << ": " << r.errors
+                      << " errors, first: " << r.firstError << std::endl;
+        }
+    }
+    if (all.empty()) {
+        std::cerr << "No orders accepted" << std::endl;
+        return 1;
+    }
+    std::sort(all.begin(), all.end());
+    auto pct = [&](double p) { return all[static_cast<size_t>(p * (all.size() - 1))]; };
+
+    std::cout << (tls ? "tls" : "plain")
+              << " connections=" << connections
+              << " accepted=" << all.size()
+              << " errors=" << errors
+              << " throughput=" << static_cast<uint64_t>(all.size() / seconds) << "/s"
+              << " p50=" << pct(0.50) << "us"
+              << " p99=" << pct(0.99) << "us"
+              << " max=" << all.back() << "us" << std::endl;
+    return errors == 0 ? 0 : 1;
+}
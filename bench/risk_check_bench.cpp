@@ -0,0 +1,161 @@
+// Micro-benchmark for the pre-trade risk check: the time RiskGate::check
+// adds to every order before it reaches the ingress queue.
+//
+// Usage: risk_check_bench [--orders N] [--threads N]
+//
+// Reports the mean cost of one check in three cases:
+//   single    one session on one thread, no other activity
+//   released  the same, while another thread releases fills for that
+//             session (the matcher contending for the session's entry)
+//   sessions  one session per thread, all checking at once (slowest thread)
+// Limits are set high enough that every check is accepted and reserves.
+#include "matching_engine.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+// Parse the whole of text as an unsigned number no larger than max
+bool parseNumber(const char* text, unsigned long long max, unsigned long long& out)
+{
+    if (!text || *text < '0' || *text > '9') {
+        return false;
+    }
+    errno = 0;
+    char* end = nullptr;
+    out = std::strtoull(text, &end, 10);
+    return errno == 0 && *end == '\0' && out <= max;
+}
+
+MatchingEngine::RiskLimits benchLimits(uint32_t sessions)
+{
+    MatchingEngine::RiskLimits limits;
+    limits.maxOrderQty = 1;
+    limits.maxOpenQty = UINT64_MAX / 2;
+    limits.maxOpenNotional = 1e300;
+    limits.maxOrdersPerSec = UINT32_MAX;
+    limits.maxSessions = sessions;
+    return limits;
+}
+
+// Mean nanoseconds per check for orders checks against one session
+double timeChecks(MatchingEngine::RiskGate& gate, MatchingEngine::SessionId sid, uint32_t slot,
+                  uint64_t orders)
+{
+    MatchingEngine::Order order(1, true, MatchingEngine::OrderType::Limit, 100.0, 0.0, 1, sid, slot);
+    uint64_t accepted = 0;
+    auto t0 = Clock::now();
+    for (uint64_t i = 0; i < orders; ++i)
+    {
+        order.id = i;
+        accepted += gate.check(order, 100.0) == MatchingEngine::SubmitStatus::Accepted;
+    }
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+    if (accepted != orders) {
+        std::cerr << "only " << accepted << " of " << orders << " checks accepted" << std::endl;
+    }
+    return ns / static_cast<double>(orders);
+}
+
+void report(const std::string& name, double nsPerCheck)
+{
+    std::cout << name << " ns/check=" << nsPerCheck << std::endl;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    uint64_t orders = 10000000;
+    unsigned threads = 4;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* opt = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        unsigned long long n = 0;
+        bool ok = true;
+
+        if (std::strcmp(opt, "--orders") == 0) {
+            ok = parseNumber(value, 1000000000, n) && n > 0;
+            orders = n;
+            ++i;
+        } else if (std::strcmp(opt, "--threads") == 0) {
+            ok = parseNumber(value, 256, n) && n > 0;
+            threads = static_cast<unsigned>(n);
+            ++i;
+        } else {
+            std::cerr << "Unknown option: " << opt << std::endl;
+            return 1;
+        }
+
+        if (!ok) {
+            std::cerr << "Invalid value for " << opt << ": " << (value ? value : "(missing)") << std::endl;
+            return 1;
+        }
+    }
+
+    {
+        MatchingEngine::RiskGate gate(benchLimits(1));
+        uint32_t slot = gate.acquireSlot(1);
+        timeChecks(gate, 1, slot, orders / 10);   // warm up
+        report("single", timeChecks(gate, 1, slot, orders));
+    }
+
+    {
+        MatchingEngine::RiskGate gate(benchLimits(2));
+        uint32_t slot = gate.acquireSlot(1);
+        uint32_t makerSlot = gate.acquireSlot(2);
+
+        // a one-fill list per released order, as the matcher would produce
+        MatchingEngine::FillList fills;
+        MatchingEngine::Fill fill{};
+        fill.makerSession = 2;
+        fill.makerSessionIndex = makerSlot;
+        fill.takerSession = 1;
+        fill.takerSessionIndex = slot;
+        fill.quantity = 1;
+        fill.makerReservePrice = fill.takerReservePrice = 100.0;
+        fills.push_back(fill);
+
+        std::atomic<bool> done{false};
+        std::thread matcher([&] {
+            while (!done.load(std::memory_order_relaxed)) {
+                gate.onFills(fills);
+            }
+        });
+        report("released", timeChecks(gate, 1, slot, orders));
+        done = true;
+        matcher.join();
+    }
+
+    {
+        MatchingEngine::RiskGate gate(benchLimits(threads));
+        std::vector<double> nsPerCheck(threads);
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&, t] {
+                uint32_t slot = gate.acquireSlot(t + 1);
+                nsPerCheck[t] = timeChecks(gate, t + 1, slot, orders);
+            });
+        }
+        double worst = 0.0;
+        for (unsigned t = 0; t < threads; ++t)
+        {
+            workers[t].join();
+            worst = std::max(worst, nsPerCheck[t]);
+        }
+        report("sessions threads=" + std::to_string(threads), worst);
+    }
+    return 0;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <linux/tls.h>
+#include <cstddef>
+#include <cstring>
+
+namespace KernelTls
+{
+// Result of trying to hand a session's record layer to the kernel
+enum class OffloadResult
+{
+    Offloaded,  // reads and writes now go straight to the socket
+    UserSpace,  // nothing changed; keep using the SSL stream
+    Failed      // the socket is half-configured and must be closed
+};
+
+// Prepare a server context for offload: capture the TLS 1.3 traffic
+// secrets as they are derived and stop post-handshake session tickets, so
+// the record sequence numbers are still zero when the handshake completes.
+void configureContext(SSL_CTX* ctx);
+
+// After a completed handshake, install the session keys with kernel TLS
+// (TCP_ULP "tls", TLS_TX/TLS_RX). Only TLS 1.3 AES-GCM sessions with no
+// buffered records are offloaded; everything else stays in user space.
+OffloadResult offload(SSL* ssl, int fd);
+
+// HKDF-Expand-Label from RFC 8446 section 7.1, with an empty context
+bool expandLabel(const EVP_MD* md, const unsigned char* secret, size_t secretLen,
+                 const char* label, unsigned char* out, size_t outLen);
+
+// Fill a kernel crypto_info from a traffic secret; TLS 1.3 splits the 12
+// byte write IV into the kernel's 4 byte salt and 8 byte explicit IV
+template <typename CryptoInfo>
+bool buildCryptoInfo(CryptoInfo& info, unsigned short cipherType, const EVP_MD* md,
+                     const unsigned char* secret, size_t secretLen)
+{
+    unsigned char iv[sizeof(info.salt) + sizeof(info.iv)];
+    std::memset(&info, 0, sizeof(info));
+    info.info.version = TLS_1_3_VERSION;
+    info.info.cipher_type = cipherType;
+
+    if (!expandLabel(md, secret, secretLen, "key", info.key, sizeof(info.key))
+        || !expandLabel(md, secret, secretLen, "iv", iv, sizeof(iv))) {
+        return false;
+    }
+    std::memcpy(info.salt, iv, sizeof(info.salt));
+    std::memcpy(info.iv, iv + sizeof(info.salt), sizeof(info.iv));
+    OPENSSL_cleanse(iv, sizeof(iv));
+    return true;
+}
+
+} // namespace KernelTls
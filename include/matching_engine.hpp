@@ -9,15 +9,32 @@
 #include <atomic>
 #include <condition_variable>
 #include <thread>
+#include <mutex>
+#include <cstdint>
+#include <memory_resource>
+#include <type_traits>
 #include <boost/asio.hpp>
 
+#include "memory_arena.hpp"
+
 namespace MatchingEngine
 {
 // A SessionId to identify each TCP connection
 using SessionId = uint64_t;
 
+// Index of a session's slot in the engine's flat per-session tables
+constexpr uint32_t kNoSessionIndex = UINT32_MAX;
+
 // Order types
-enum class OrderType { Market, Limit, StopLoss };
+enum class OrderType { Market, Limit, StopLoss, ImmediateOrCancel, FillOrKill };
+
+// Types that carry a limit price and may only trade at it or better
+inline bool hasLimitPrice(OrderType type)
+{
+    return type == OrderType::Limit
+        || type == OrderType::ImmediateOrCancel
+        || type == OrderType::FillOrKill;
+}
 
 // Each incoming order
 struct Order
@@ -28,20 +45,25 @@ struct Order
     double price;       // limit or trigger price
     double stopPrice;   // used if type == StopLoss
     uint64_t quantity;
+    double reservePrice;  // per-unit notional reserved by the risk gate
 
     // Which session placed this order
     SessionId sessionId;
+    uint32_t sessionIndex;
 
     std::chrono::steady_clock::time_point timestamp;
 
-    Order(uint64_t _id, bool buy, OrderType _type, double p, double sp, uint64_t qty, SessionId sid)
+    Order(uint64_t _id, bool buy, OrderType _type, double p, double sp, uint64_t qty, SessionId sid,
+          uint32_t sidx = kNoSessionIndex)
       : id(_id)
       , isBuy(buy)
       , type(_type)
       , price(p)
       , stopPrice(sp)
       , quantity(qty)
+      , reservePrice(0.0)
       , sessionId(sid)
+      , sessionIndex(sidx)
       , timestamp(std::chrono::steady_clock::now())
     {}
 };
@@ -55,11 +77,154 @@ struct Fill
     // maker/taker sessions (so we know who to notify)
     SessionId makerSession;
     SessionId takerSession;
+    uint32_t makerSessionIndex;
+    uint32_t takerSessionIndex;
 
     double price;
     uint64_t quantity;
     // perspective of the taker: is the taker buying?
     bool isBuy;
+
+    // per-unit notional each side reserved, so the risk gate releases
+    // exactly what it took rather than the trade price
+    double makerReservePrice;
+    double takerReservePrice;
+};
+
+// Fills produced by one call into the book, allocated from the book's memory
+using FillList = std::pmr::vector<Fill>;
+
+// Resting orders are stored as a compact hot record in the book; only what
+// matching touches lives here. Side and type are implied by the container
+// (everything resting is a limit order), so no flag bits are needed.
+struct RestingOrder
+{
+    uint64_t id;
+    int64_t  priceTicks;
+    uint64_t quantity;      // remaining
+    uint32_t sessionIndex;
+    uint32_t coldIndex;     // slot in the book's cold table
+};
+static_assert(sizeof(RestingOrder) == 32, "RestingOrder should stay two per cache line");
+
+// Rarely read attributes of a resting order, kept out of the price levels
+struct RestingOrderCold
+{
+    SessionId sessionId;
+    std::chrono::steady_clock::time_point timestamp;
+    double reservePrice;
+};
+
+// Outcome of submitting an order to the engine
+enum class SubmitStatus
+{
+    Accepted,
+    UnknownSession,
+    InvalidQuantity,
+    InvalidPrice,
+    NoReferencePrice,
+    MaxQuantity,
+    PriceCollar,
+    OpenQuantity,
+    OpenNotional,
+    RateLimit,
+    Busy
+};
+
+// Short wire name for a status, e.g. "max-quantity"
+const char* toString(SubmitStatus status);
+
+// Pre-trade limits, applied to every session
+struct RiskLimits
+{
+    uint64_t maxOrderQty     = 1000000;    // largest single order
+    double   priceCollarPct  = 0.10;       // max limit price deviation from last trade
+    uint64_t maxOpenQty      = 10000000;   // unfilled quantity per session
+    double   maxOpenNotional = 1e9;        // unfilled quantity * price per session
+    uint32_t maxOrdersPerSec = 1000;       // throttle rate, also the burst size
+    uint32_t maxSessions     = 1024;       // size of the per-session tables
+};
+
+// Up-front storage for the book, ingress queue and fills. Everything is
+// carved from one arena reserved at construction and pre-faulted at start().
+struct MemoryPolicy
+{
+    size_t maxRestingOrders = 1 << 18;
+    size_t maxPriceLevels   = 1 << 14;
+    size_t maxStopOrders    = 1 << 14;
+    PageKind pages          = PageKind::Transparent;  // falls back to Normal
+    bool lockMemory         = false;                  // mlock the arena at start()
+};
+
+// Startup configuration for the engine
+struct EngineConfig
+{
+    RiskLimits risk;
+    MemoryPolicy memory;
+
+    int64_t ticksPerUnit = 10000;   // book prices are integer ticks of 1/ticksPerUnit
+
+    size_t maxQueueDepth   = 65536;  // orders accepted but not yet matched; beyond this -> Busy
+    size_t pauseReadDepth  = 49152;  // sessions stop reading above this depth
+    size_t resumeReadDepth = 16384;  // and are woken once it drains back to this
+};
+
+// Ingress queue metrics
+struct IngressStats
+{
+    size_t depth = 0;
+    size_t highWaterMark = 0;
+    uint64_t rejectedBusy = 0;
+};
+
+// Pre-trade risk checks. Per-session state lives in a flat table indexed by
+// the session slot, so a check is a handful of arithmetic ops on one entry.
+// Each entry has its own lock, so sessions never wait on each other; only a
+// session's io thread and the matcher releasing its fills share one.
+class RiskGate
+{
+public:
+    explicit RiskGate(const RiskLimits& limits);
+
+    // Claim a table slot for a new session; kNoSessionIndex if the table is full
+    uint32_t acquireSlot(SessionId sid);
+    void releaseSlot(uint32_t slot);
+
+    // Check an order and, if accepted, reserve its quantity against the session
+    // and record the per-unit notional taken in order.reservePrice.
+    // referencePrice is the last trade, or the touch for a market order
+    // before the first trade; limits are collared and market orders are
+    // reserved against it.
+    SubmitStatus check(Order& order, double referencePrice);
+
+    // Return reserved quantity once it has traded or been dropped. onFills
+    // takes each session's lock once per run of its fills, not per fill.
+    void onFill(const Fill& fill);
+    void onFills(const FillList& fills);
+    void onExpired(const Order& order);
+
+    uint64_t openQuantity(uint32_t slot) const;
+    double openNotional(uint32_t slot) const;
+
+private:
+    // a cache line each, so io threads checking different sessions don't
+    // bounce each other's entries
+    struct alignas(64) SessionRisk
+    {
+        mutable std::atomic<bool> busy{false};  // spin lock for the fields below
+        SessionId owner = 0;
+        uint64_t openQty = 0;
+        double openNotional = 0.0;
+        double tokens = 0.0;
+        std::chrono::steady_clock::time_point lastRefill;
+    };
+
+    RiskLimits limits_;
+    std::vector<SessionRisk> sessions_;  // never resized after construction
+    std::vector<uint32_t> freeSlots_;
+    std::mutex slotMutex_;               // guards freeSlots_ only
+
+    void release(uint32_t slot, SessionId sid, uint64_t qty, double notional);
 };
 
 // Forward declare the engine so OrderBook can refer to it
@@ -69,61 +234,144 @@ class MatchingEngine;
 class OrderBook
 {
 public:
-    // pass pointer to the parent engine for fill notifications
-    explicit OrderBook(MatchingEngine* parent);
+    // pass pointer to the parent engine for fill notifications; all book
+    // storage and returned fills come from resource
+    explicit OrderBook(MatchingEngine* parent, int64_t ticksPerUnit = 10000,
+                       std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+    // Size the order tables up front so they don't regrow while matching
+    void reserve(size_t restingOrders, size_t stopOrders);
+
+    // Market orders stop sweeping once the price is more than pct away from
+    // the last trade, or from the touch before the first trade; triggered
+    // stops once it is more than pct past their stop price. 0 leaves both
+    // unbounded.
+    void setMarketCollar(double pct) { marketCollarPct_ = pct; }
 
     // Add an order to the book; returns a list of fills that occurred
-    std::vector<Fill> addOrder(Order&& order);
+    FillList addOrder(Order&& order);
+    // Same, appending to a caller-owned list so its capacity is reused
+    void addOrder(Order&& order, FillList& fills);
 
-private:
-    using PriceLevel = std::deque<Order>;
+    // Top of book, 0.0 if the side is empty; published after every order
+    // so any thread can read it without taking the book lock
+    double bestBid() const { return bestBidPrice_.load(std::memory_order_relaxed); }
+    double bestAsk() const { return bestAskPrice_.load(std::memory_order_relaxed); }
+
+    // Last traded price, readable from any thread
+    double lastPrice() const { return lastTradePrice.load(std::memory_order_relaxed); }
 
-    // For buy side, we sort in descending price
-    struct Descending
+    // Number of orders resting on both sides
+    size_t restingCount() const;
+
+private:
+    // Orders at one price in time priority, plus their total remaining
+    // quantity so depth can be read without walking the queue
+    // (allocator-aware so the map hands its resource down to the deque)
+    struct PriceLevel
     {
-        bool operator()(double a, double b) const { return a > b; }
+        using allocator_type = std::pmr::polymorphic_allocator<RestingOrder>;
+
+        explicit PriceLevel(const allocator_type& alloc = {}) : orders(alloc) {}
+        PriceLevel(const PriceLevel& other, const allocator_type& alloc)
+          : orders(other.orders, alloc), totalQty(other.totalQty) {}
+        PriceLevel(PriceLevel&& other, const allocator_type& alloc)
+          : orders(std::move(other.orders), alloc), totalQty(other.totalQty) {}
+
+        std::pmr::deque<RestingOrder> orders;
+        uint64_t totalQty = 0;
     };
 
-    // The buy book (keyed descending) and sell book (ascending)
-    std::map<double, PriceLevel, Descending> buyBook;
-    std::map<double, PriceLevel> sellBook;
+    std::pmr::memory_resource* resource_;
+
+    // The buy book (keyed descending) and sell book (ascending), in ticks
+    std::pmr::map<int64_t, PriceLevel, std::greater<int64_t>> buyBook;
+    std::pmr::map<int64_t, PriceLevel> sellBook;
+
+    // Cold attributes of resting orders, indexed by RestingOrder::coldIndex
+    std::pmr::vector<RestingOrderCold> coldOrders;
+    std::pmr::vector<uint32_t> freeColdSlots;
+    size_t restingOrders = 0;
+
+    int64_t ticksPerUnit_;
+    double marketCollarPct_ = 0.0;
 
     // We keep stop orders off-book until triggered
-    std::vector<Order> stopOrders;
+    std::pmr::vector<Order> stopOrders;
 
-    double lastTradePrice = 0.0;          // track last match price for stop triggers
+    std::atomic<double> lastTradePrice{0.0};  // track last match price for stop triggers
+    std::atomic<double> bestBidPrice_{0.0};
+    std::atomic<double> bestAskPrice_{0.0};
     MatchingEngine* parentEngine_ = nullptr;
     mutable std::mutex bookMutex;
 
-    std::vector<Fill> matchOrder(Order& incoming);
-    void consumeOrder(Order& taker, Order& maker, double matchPrice, std::vector<Fill>& fills);
+    int64_t toLimitTicks(double price, bool isBuy) const;
+    bool marketBandTicks(bool isBuy, int64_t& bandTicks) const;
+    double toPrice(int64_t ticks) const { return static_cast<double>(ticks) / ticksPerUnit_; }
+
+    void matchOrder(Order& incoming, FillList& fills);
+    bool canFillCompletely(const Order& incoming) const;
+    void consumeOrder(Order& taker, PriceLevel& level, FillList& fills);
     void placeLimitOrder(Order&& order);
-    std::vector<Fill> checkStopOrders(double tradedPrice);
+    void releaseCold(uint32_t coldIndex);
+    void checkStopOrders(double tradedPrice, FillList& fills);
+    void publishTouch();
 };
 
 // The main MatchingEngine class
 class MatchingEngine
 {
 public:
-    MatchingEngine();
+    explicit MatchingEngine(const EngineConfig& config = EngineConfig{});
     ~MatchingEngine();
 
+    // start() pre-faults (and optionally mlocks) the engine's memory before
+    // the matching thread runs
     void start();
     void stop();
 
-    // The interface to place a new order
-    void submitOrder(Order&& order);
+    MemoryStats memoryStats() const { return arena_.stats(); }
+
+    // The interface to place a new order; runs pre-trade risk checks first
+    // and returns Busy if the ingress queue is full
+    SubmitStatus submitOrder(Order&& order);
 
-    // Register/unregister session callbacks for fill notifications
-    void registerSession(SessionId sid, std::function<void(const Fill&)>&& cb);
+    // True while the ingress queue is deep enough that sessions should stop reading
+    bool ingressCongested() const;
+    // Run resume once the queue has drained to the resume depth: at once if
+    // it already has, otherwise on the matching thread, so it should only
+    // post work elsewhere
+    void whenIngressDrained(std::function<void()>&& resume);
+    IngressStats ingressStats() const;
+    void resetHighWaterMark();
+
+    // Register/unregister session callbacks for fill notifications.
+    // Returns the session's index, to be stamped on its orders, or
+    // kNoSessionIndex without registering anything if all slots are taken.
+    uint32_t registerSession(SessionId sid, std::function<void(const Fill&)>&& cb);
     void unregisterSession(SessionId sid);
 
     // Called by OrderBook to distribute fill events
-    void notifyFills(const std::vector<Fill>& fills);
+    void notifyFills(const FillList& fills);
+
+    // Called by OrderBook when unfilled quantity is dropped (market remainder)
+    void onOrderExpired(const Order& order);
+
+    const RiskGate& riskGate() const { return riskGate_; }
 
 private:
+    // Backing memory for the book and ingress; declared first so it
+    // outlives everything allocated from it
+    MemoryArena arena_;
+    std::pmr::unsynchronized_pool_resource bookPool_;
+    bool lockMemory_;
+
     // A single OrderBook for demonstration
     OrderBook book_;
+    RiskGate riskGate_;
+    size_t maxQueueDepth_;
+    size_t pauseReadDepth_;
+    size_t resumeReadDepth_;
 
     // concurrency
     std::atomic<bool> running_;
@@ -132,13 +380,38 @@ private:
     std::condition_variable cv_;
 
     struct OrderMsg { Order order; };
-    std::deque<OrderMsg> orderQueue_;
+    static_assert(std::is_trivially_destructible<OrderMsg>::value, "ring slots are never destroyed");
+    static constexpr size_t kMaxBatch = 256;
+    static constexpr size_t kInitialFills = 1024;
+
+    // fixed-capacity ring of maxQueueDepth_ slots in the arena, under queueMutex_
+    OrderMsg* queueSlots_ = nullptr;
+    size_t queueHead_ = 0;
+    size_t queueCount_ = 0;
+
+    // orders moved out of the ring for matching, and the fills they
+    // produce; reused across orders, on the matching thread only
+    std::pmr::vector<OrderMsg> batch_;
+    FillList fills_;
+
+    // queued plus in-progress orders; updated under queueMutex_, read lock-free
+    std::atomic<size_t> queueDepth_{0};
+    std::atomic<size_t> queueHighWater_{0};
+    std::atomic<uint64_t> rejectedBusy_{0};
+
+    // sessions paused on a congested queue; the matcher only takes
+    // drainMutex_ while drainWaiting_ is set
+    std::vector<std::function<void()>> drainWaiters_;
+    std::atomic<bool> drainWaiting_{false};
+    std::mutex drainMutex_;
 
     // callbacks for real-time fill notifications
     std::unordered_map<SessionId, std::function<void(const Fill&)>> sessionCallbacks_;
+    std::unordered_map<SessionId, uint32_t> sessionSlots_;
     std::mutex callbackMutex_;
 
     void matchingLoop();
+    void wakeDrainWaiters();
 };
 
 } // namespace MatchingEngine
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory_resource>
+
+namespace MatchingEngine
+{
+// Which pages back a MemoryArena
+enum class PageKind { Normal, Transparent, Explicit };
+
+// Short name for logs, e.g. "transparent"
+const char* toString(PageKind kind);
+
+// Footprint of a MemoryArena
+struct MemoryStats
+{
+    size_t reservedBytes = 0;   // mapped up front
+    size_t usedBytes = 0;       // handed out from the mapping
+    size_t overflowBytes = 0;   // served by the heap after the mapping ran out
+    PageKind pages = PageKind::Normal;
+    bool prefaulted = false;
+    bool locked = false;
+};
+
+// A region reserved once with mmap and handed out by bumping a pointer.
+// Explicit huge pages (MAP_HUGETLB) fall back to transparent huge pages,
+// which fall back to normal pages. Memory is never returned to the arena;
+// callers put a pool on top for reuse. Requests beyond the reservation go
+// to the heap, so running out degrades to normal allocation.
+// Allocation is not thread-safe: the engine only allocates from the matching
+// thread. stats() may be read from any thread while it does; the counters
+// are relaxed atomics, so a reading is current but not a consistent snapshot.
+class MemoryArena : public std::pmr::memory_resource
+{
+public:
+    MemoryArena(size_t bytes, PageKind preferred);
+    ~MemoryArena() override;
+
+    MemoryArena(const MemoryArena&) = delete;
+    MemoryArena& operator=(const MemoryArena&) = delete;
+
+    // Touch every page so first-use faults happen now
+    void prefault();
+    // Pin the mapping in RAM; false if mlock fails (e.g. RLIMIT_MEMLOCK)
+    bool lock();
+
+    MemoryStats stats() const;
+
+private:
+    char* base_ = nullptr;
+    size_t size_ = 0;
+    std::atomic<size_t> used_{0};
+    std::atomic<size_t> overflow_{0};
+    PageKind pages_ = PageKind::Normal;
+    bool prefaulted_ = false;   // set before the engine's matching thread starts
+    bool locked_ = false;
+
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+};
+
+} // namespace MatchingEngine
@@ -0,0 +1,188 @@
+#include "ktls.hpp"
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/crypto.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <cstring>
+#include <string>
+
+namespace KernelTls
+{
+
+namespace
+{
+// TLS 1.3 application traffic secrets for one connection, filled in by the
+// keylog callback and hung off the SSL object as ex_data
+struct TrafficSecrets
+{
+    unsigned char client[EVP_MAX_MD_SIZE];
+    unsigned char server[EVP_MAX_MD_SIZE];
+    size_t clientLen = 0;
+    size_t serverLen = 0;
+};
+
+void freeSecrets(void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*)
+{
+    if (ptr) {
+        OPENSSL_cleanse(ptr, sizeof(TrafficSecrets));
+        delete static_cast<TrafficSecrets*>(ptr);
+    }
+}
+
+int secretsIndex()
+{
+    static int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, freeSecrets);
+    return index;
+}
+
+size_t decodeHex(const char* hex, size_t hexLen, unsigned char* out, size_t outCap)
+{
+    auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    if (hexLen % 2 != 0 || hexLen / 2 > outCap) {
+        return 0;
+    }
+    for (size_t i = 0; i < hexLen / 2; ++i)
+    {
+        int hi = nibble(hex[2 * i]);
+        int lo = nibble(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            return 0;
+        }
+        out[i] = static_cast<unsigned char>((hi << 4) | lo);
+    }
+    return hexLen / 2;
+}
+
+// Lines look like "SERVER_TRAFFIC_SECRET_0 <client random> <secret>"
+void keylogCallback(const SSL* ssl, const char* line)
+{
+    bool isClient = std::strncmp(line, "CLIENT_TRAFFIC_SECRET_0 ", 24) == 0;
+    bool isServer = std::strncmp(line, "SERVER_TRAFFIC_SECRET_0 ", 24) == 0;
+    if (!isClient && !isServer) {
+        return;
+    }
+    const char* secret = std::strrchr(line, ' ');
+    if (!secret) {
+        return;
+    }
+    ++secret;
+
+    auto* secrets = static_cast<TrafficSecrets*>(SSL_get_ex_data(ssl, secretsIndex()));
+    if (!secrets)
+    {
+        secrets = new TrafficSecrets;
+        if (!SSL_set_ex_data(const_cast<SSL*>(ssl), secretsIndex(), secrets)) {
+            delete secrets;
+            return;
+        }
+    }
+    if (isClient) {
+        secrets->clientLen = decodeHex(secret, std::strlen(secret), secrets->client, sizeof(secrets->client));
+    } else {
+        secrets->serverLen = decodeHex(secret, std::strlen(secret), secrets->server, sizeof(secrets->server));
+    }
+}
+
+template <typename CryptoInfo>
+OffloadResult install(int fd, unsigned short cipherType, const EVP_MD* md, const TrafficSecrets& secrets)
+{
+    CryptoInfo tx, rx;
+    OffloadResult result = OffloadResult::UserSpace;
+
+    if (buildCryptoInfo(tx, cipherType, md, secrets.server, secrets.serverLen)
+        && buildCryptoInfo(rx, cipherType, md, secrets.client, secrets.clientLen)
+        && setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == 0
+        && setsockopt(fd, SOL_TLS, TLS_TX, &tx, sizeof(tx)) == 0)
+    {
+        // once TX is in the kernel there is no way back to user space
+        result = setsockopt(fd, SOL_TLS, TLS_RX, &rx, sizeof(rx)) == 0
+            ? OffloadResult::Offloaded
+            : OffloadResult::Failed;
+    }
+    OPENSSL_cleanse(&tx, sizeof(tx));
+    OPENSSL_cleanse(&rx, sizeof(rx));
+    return result;
+}
+} // namespace
+
+bool expandLabel(const EVP_MD* md, const unsigned char* secret, size_t secretLen,
+                 const char* label, unsigned char* out, size_t outLen)
+{
+    std::string fullLabel = std::string("tls13 ") + label;
+    std::string info;
+    info.push_back(static_cast<char>(outLen >> 8));
+    info.push_back(static_cast<char>(outLen & 0xff));
+    info.push_back(static_cast<char>(fullLabel.size()));
+    info += fullLabel;
+    info.push_back(0);
+
+    EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr);
+    bool ok = pctx
+        && EVP_PKEY_derive_init(pctx) > 0
+        && EVP_PKEY_CTX_set_hkdf_mode(pctx, EVP_PKEY_HKDEF_MODE_EXPAND_ONLY) > 0
+        && EVP_PKEY_CTX_set_hkdf_md(pctx, md) > 0
+        && EVP_PKEY_CTX_set1_hkdf_key(pctx, secret, static_cast<int>(secretLen)) > 0
+        && EVP_PKEY_CTX_add1_hkdf_info(pctx, reinterpret_cast<const unsigned char*>(info.data()),
+                                       static_cast<int>(info.size())) > 0
+        && EVP_PKEY_derive(pctx, out, &outLen) > 0;
+    EVP_PKEY_CTX_free(pctx);
+    return ok;
+}
+
+void configureContext(SSL_CTX* ctx)
+{
+    secretsIndex();
+    SSL_CTX_set_keylog_callback(ctx, keylogCallback);
+    SSL_CTX_set_num_tickets(ctx, 0);
+    // without read-ahead OpenSSL only asks for input once it has drained
+    // the read BIO, which offload() relies on (see the Session's handshake)
+    SSL_CTX_set_read_ahead(ctx, 0);
+}
+
+OffloadResult offload(SSL* ssl, int fd)
+{
+    if (SSL_version(ssl) != TLS1_3_VERSION) {
+        return OffloadResult::UserSpace;
+    }
+
+    // records already read or queued by OpenSSL would be lost to the kernel
+    if (SSL_has_pending(ssl)
+        || BIO_ctrl_pending(SSL_get_rbio(ssl)) > 0
+        || BIO_ctrl_wpending(SSL_get_wbio(ssl)) > 0) {
+        return OffloadResult::UserSpace;
+    }
+
+    auto* secrets = static_cast<TrafficSecrets*>(SSL_get_ex_data(ssl, secretsIndex()));
+    if (!secrets || secrets->clientLen == 0 || secrets->serverLen == 0) {
+        return OffloadResult::UserSpace;
+    }
+
+    OffloadResult result = OffloadResult::UserSpace;
+    switch (SSL_CIPHER_get_id(SSL_get_current_cipher(ssl)))
+    {
+        case TLS1_3_CK_AES_128_GCM_SHA256:
+            result = install<tls12_crypto_info_aes_gcm_128>(fd, TLS_CIPHER_AES_GCM_128,
+                                                            EVP_sha256(), *secrets);
+            break;
+        case TLS1_3_CK_AES_256_GCM_SHA384:
+            result = install<tls12_crypto_info_aes_gcm_256>(fd, TLS_CIPHER_AES_GCM_256,
+                                                            EVP_sha384(), *secrets);
+            break;
+        default:
+            break;
+    }
+
+    // the secrets are no longer needed either way
+    OPENSSL_cleanse(secrets, sizeof(TrafficSecrets));
+    secrets->clientLen = secrets->serverLen = 0;
+    return result;
+}
+
+} // namespace KernelTls
@@ -2,16 +2,133 @@
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include <csignal>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <string>
 
 #include "server.cpp"
 
-int main()
+namespace
 {
+// Parse the whole of text as an unsigned number no larger than max
+bool parseNumber(const char* text, unsigned long long max, unsigned long long& out)
+{
+    if (!text || *text < '0' || *text > '9') {
+        return false;  // strtoull would quietly accept "-1" or " 5"
+    }
+    errno = 0;
+    char* end = nullptr;
+    out = std::strtoull(text, &end, 10);
+    return errno == 0 && *end == '\0' && out <= max;
+}
+} // namespace
+
+// Usage: order_matching_engine [--port N] [--plain-port N] [--plain-bind ADDR]
+//                              [--max-orders-per-sec N] [--max-resting-orders N]
+//                              [--max-queue-depth N] [--pause-read-depth N] [--resume-read-depth N]
+//                              [--huge-pages explicit|transparent|none] [--mlock]
+//   --plain-port N  also listen for plaintext clients (trusted networks only)
+//   --plain-bind    address for the plaintext listener (default 127.0.0.1)
+//   --huge-pages    pages backing the engine's pre-reserved memory (default transparent)
+//   --max-queue-depth    orders queued for matching before new ones are rejected busy
+//   --pause-read-depth   queue depth at which sessions stop reading their sockets
+//   --resume-read-depth  depth the queue must drain to before they read again
+int main(int argc, char** argv)
+{
+    MatchingEngine::EngineConfig config;
+    unsigned short port = 12345;
+    unsigned short plainPort = 0;
+    std::string plainBind = "127.0.0.1";
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* opt = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        unsigned long long n = 0;
+        bool ok = true;
+
+        if (std::strcmp(opt, "--mlock") == 0) {
+            config.memory.lockMemory = true;
+        } else if (std::strcmp(opt, "--port") == 0) {
+            ok = parseNumber(value, 65535, n) && n > 0;
+            port = static_cast<unsigned short>(n);
+            ++i;
+        } else if (std::strcmp(opt, "--plain-port") == 0) {
+            ok = parseNumber(value, 65535, n) && n > 0;
+            plainPort = static_cast<unsigned short>(n);
+            ++i;
+        } else if (std::strcmp(opt, "--plain-bind") == 0) {
+            ok = value != nullptr;
+            plainBind = value ? value : "";
+            ++i;
+        } else if (std::strcmp(opt, "--max-orders-per-sec") == 0) {
+            ok = parseNumber(value, UINT32_MAX, n) && n > 0;
+            config.risk.maxOrdersPerSec = static_cast<uint32_t>(n);
+            ++i;
+        } else if (std::strcmp(opt, "--max-resting-orders") == 0) {
+            ok = parseNumber(value, UINT32_MAX, n) && n > 0;
+            config.memory.maxRestingOrders = static_cast<size_t>(n);
+            ++i;
+        } else if (std::strcmp(opt, "--max-queue-depth") == 0) {
+            ok = parseNumber(value, 1 << 22, n) && n > 0;
+            config.maxQueueDepth = static_cast<size_t>(n);
+            ++i;
+        } else if (std::strcmp(opt, "--pause-read-depth") == 0) {
+            ok = parseNumber(value, 1 << 22, n) && n > 0;
+            config.pauseReadDepth = static_cast<size_t>(n);
+            ++i;
+        } else if (std::strcmp(opt, "--resume-read-depth") == 0) {
+            ok = parseNumber(value, 1 << 22, n);
+            config.resumeReadDepth = static_cast<size_t>(n);
+            ++i;
+        } else if (std::strcmp(opt, "--huge-pages") == 0) {
+            if (value && std::strcmp(value, "explicit") == 0) {
+                config.memory.pages = MatchingEngine::PageKind::Explicit;
+            } else if (value && std::strcmp(value, "transparent") == 0) {
+                config.memory.pages = MatchingEngine::PageKind::Transparent;
+            } else if (value && std::strcmp(value, "none") == 0) {
+                config.memory.pages = MatchingEngine::PageKind::Normal;
+            } else {
+                ok = false;
+            }
+            ++i;
+        } else {
+            std::cerr << "Unknown option: " << opt << std::endl;
+            return 1;
+        }
+
+        if (!ok) {
+            std::cerr << "Invalid value for " << opt << ": " << (value ? value : "(missing)") << std::endl;
+            return 1;
+        }
+    }
+
+    if (config.resumeReadDepth > config.pauseReadDepth || config.pauseReadDepth > config.maxQueueDepth) {
+        std::cerr << "Queue depths must satisfy --resume-read-depth <= --pause-read-depth"
+                  << " <= --max-queue-depth" << std::endl;
+        return 1;
+    }
+
+    boost::system::error_code bindError;
+    auto plainAddress = boost::asio::ip::make_address(plainBind, bindError);
+    if (bindError) {
+        std::cerr << "Invalid value for --plain-bind: " << plainBind << std::endl;
+        return 1;
+    }
+
     // Prepare the matching engine
-    MatchingEngine::MatchingEngine engine;
+    MatchingEngine::MatchingEngine engine(config);
     engine.start();
 
+    auto mem = engine.memoryStats();
+    std::cout << "Engine memory: " << (mem.reservedBytes >> 20) << " MiB reserved ("
+              << MatchingEngine::toString(mem.pages) << " pages"
+              << (mem.prefaulted ? ", pre-faulted" : "")
+              << (mem.locked ? ", locked" : "") << ")" << std::endl;
+
     // Setup Boost.Asio
     boost::asio::io_context ioc;
     namespace ssl = boost::asio::ssl;
@@ -24,10 +141,16 @@ int main()
                     | ssl::context::no_sslv2
                     | ssl::context::single_dh_use);
 
-    unsigned short port = 12345;
     try
     {
+        // kernel TLS offload stays off until it has been measured on a
+        // kernel with the tls module
         Server::Server server(ioc, port, ctx, engine);
+        std::unique_ptr<Server::Server> plainServer;
+        if (plainPort != 0) {
+            plainServer = std::make_unique<Server::Server>(ioc, plainAddress, plainPort, engine);
+            std::cout << "Plaintext listener on " << plainAddress << ":" << plainPort << std::endl;
+        }
 
         boost::asio::signal_set signals(ioc, SIGINT, SIGTERM);
         signals.async_wait([&](const boost::system::error_code&, int){ ioc.stop(); });
@@ -42,5 +165,9 @@ int main()
 
     // Cleanup
     engine.stop();
+
+    auto stats = engine.ingressStats();
+    std::cout << "Ingress high-water mark " << stats.highWaterMark
+              << ", busy rejects " << stats.rejectedBusy << std::endl;
     return 0;
 }
@@ -1,56 +1,364 @@
 #include "matching_engine.hpp"
 #include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <new>
 
 namespace MatchingEngine
 {
 
+const char* toString(SubmitStatus status)
+{
+    switch (status)
+    {
+        case SubmitStatus::Accepted:        return "accepted";
+        case SubmitStatus::UnknownSession:  return "unknown-session";
+        case SubmitStatus::InvalidQuantity: return "invalid-quantity";
+        case SubmitStatus::InvalidPrice:    return "invalid-price";
+        case SubmitStatus::NoReferencePrice: return "no-reference-price";
+        case SubmitStatus::MaxQuantity:     return "max-quantity";
+        case SubmitStatus::PriceCollar:     return "price-collar";
+        case SubmitStatus::OpenQuantity:    return "open-quantity";
+        case SubmitStatus::OpenNotional:    return "open-notional";
+        case SubmitStatus::RateLimit:       return "rate-limit";
+        case SubmitStatus::Busy:            return "busy";
+    }
+    return "unknown";
+}
+
+// ===================
+// RiskGate
+// ===================
+
+namespace
+{
+// Holds a session's risk entry for a few arithmetic ops, which is far
+// shorter than parking and waking a thread on a mutex. Yields if the holder
+// seems to have been descheduled rather than burning the rest of a slice.
+class SpinGuard
+{
+public:
+    explicit SpinGuard(std::atomic<bool>& flag) : flag_(flag)
+    {
+        while (flag_.exchange(true, std::memory_order_acquire))
+        {
+            for (int spins = 0; flag_.load(std::memory_order_relaxed); ++spins)
+            {
+                if (spins >= 64) {
+                    std::this_thread::yield();
+                }
+#if defined(__x86_64__) || defined(__i386__)
+                __builtin_ia32_pause();
+#endif
+            }
+        }
+    }
+    ~SpinGuard() { flag_.store(false, std::memory_order_release); }
+
+    SpinGuard(const SpinGuard&) = delete;
+    SpinGuard& operator=(const SpinGuard&) = delete;
+
+private:
+    std::atomic<bool>& flag_;
+};
+} // namespace
+
+RiskGate::RiskGate(const RiskLimits& limits)
+  : limits_(limits)
+  , sessions_(limits.maxSessions)
+{
+    freeSlots_.reserve(limits.maxSessions);
+    for (uint32_t i = limits.maxSessions; i > 0; --i) {
+        freeSlots_.push_back(i - 1);
+    }
+}
+
+uint32_t RiskGate::acquireSlot(SessionId sid)
+{
+    uint32_t slot;
+    {
+        std::lock_guard<std::mutex> lock(slotMutex_);
+        if (freeSlots_.empty()) {
+            return kNoSessionIndex;
+        }
+        slot = freeSlots_.back();
+        freeSlots_.pop_back();
+    }
+
+    SessionRisk& s = sessions_[slot];
+    SpinGuard guard(s.busy);
+    s.owner = sid;
+    s.openQty = 0;
+    s.openNotional = 0.0;
+    s.tokens = limits_.maxOrdersPerSec;
+    s.lastRefill = std::chrono::steady_clock::now();
+    return slot;
+}
+
+void RiskGate::releaseSlot(uint32_t slot)
+{
+    if (slot >= sessions_.size()) {
+        return;
+    }
+    {
+        // clear the owner so late fills for resting orders are ignored
+        SessionRisk& s = sessions_[slot];
+        SpinGuard guard(s.busy);
+        s.owner = 0;
+    }
+    std::lock_guard<std::mutex> lock(slotMutex_);
+    freeSlots_.push_back(slot);
+}
+
+SubmitStatus RiskGate::check(Order& order, double referencePrice)
+{
+    if (order.quantity == 0) {
+        return SubmitStatus::InvalidQuantity;
+    }
+    if (order.quantity > limits_.maxOrderQty) {
+        return SubmitStatus::MaxQuantity;
+    }
+
+    // a zero, negative or NaN price would reserve nothing (or negative
+    // notional) and could become the collar's reference
+    auto validPrice = [](double p) { return std::isfinite(p) && p > 0.0; };
+    if (hasLimitPrice(order.type) && !validPrice(order.price)) {
+        return SubmitStatus::InvalidPrice;
+    }
+    if (order.type == OrderType::StopLoss && !validPrice(order.stopPrice)) {
+        return SubmitStatus::InvalidPrice;
+    }
+
+    // collar limit prices around the last trade, once there is one
+    if (hasLimitPrice(order.type) && referencePrice > 0.0)
+    {
+        double band = referencePrice * limits_.priceCollarPct;
+        if (order.price > referencePrice + band || order.price < referencePrice - band) {
+            return SubmitStatus::PriceCollar;
+        }
+    }
+
+    // market orders execute at most up to the top of the collar band (the
+    // book stops them there, and resting limits were collared on entry),
+    // so that edge is what they are worth. Stops are bounded around their
+    // own stop price once triggered, since the last trade may have gapped.
+    double reservePrice = order.price;
+    if (order.type == OrderType::Market)
+    {
+        if (referencePrice <= 0.0) {
+            return SubmitStatus::NoReferencePrice;
+        }
+        reservePrice = referencePrice * (1.0 + limits_.priceCollarPct);
+    }
+    else if (order.type == OrderType::StopLoss)
+    {
+        reservePrice = order.stopPrice * (1.0 + limits_.priceCollarPct);
+    }
+    double notional = reservePrice * static_cast<double>(order.quantity);
+
+    if (order.sessionIndex >= sessions_.size()) {
+        return SubmitStatus::UnknownSession;
+    }
+    SessionRisk& s = sessions_[order.sessionIndex];
+    SpinGuard guard(s.busy);
+    if (s.owner != order.sessionId) {
+        return SubmitStatus::UnknownSession;
+    }
+
+    // token bucket throttle, refilled from the order's own timestamp
+    double elapsed = std::chrono::duration<double>(order.timestamp - s.lastRefill).count();
+    if (elapsed > 0.0)
+    {
+        s.tokens = std::min<double>(limits_.maxOrdersPerSec,
+                                    s.tokens + elapsed * limits_.maxOrdersPerSec);
+        s.lastRefill = order.timestamp;
+    }
+    if (s.tokens < 1.0) {
+        return SubmitStatus::RateLimit;
+    }
+    s.tokens -= 1.0;
+
+    if (s.openQty + order.quantity > limits_.maxOpenQty) {
+        return SubmitStatus::OpenQuantity;
+    }
+    if (s.openNotional + notional > limits_.maxOpenNotional) {
+        return SubmitStatus::OpenNotional;
+    }
+
+    s.openQty += order.quantity;
+    s.openNotional += notional;
+    order.reservePrice = reservePrice;
+    return SubmitStatus::Accepted;
+}
+
+void RiskGate::onFill(const Fill& fill)
+{
+    release(fill.makerSessionIndex, fill.makerSession, fill.quantity,
+            fill.makerReservePrice * static_cast<double>(fill.quantity));
+    release(fill.takerSessionIndex, fill.takerSession, fill.quantity,
+            fill.takerReservePrice * static_cast<double>(fill.quantity));
+}
+
+void RiskGate::onFills(const FillList& fills)
+{
+    // a sweep is one taker against a run of makers, often from the same
+    // session, so add up consecutive fills per side and release each run once
+    struct Run
+    {
+        uint32_t slot = kNoSessionIndex;
+        SessionId sid = 0;
+        uint64_t qty = 0;
+        double notional = 0.0;
+    };
+    auto add = [this](Run& run, uint32_t slot, SessionId sid, uint64_t qty, double reservePrice)
+    {
+        if (run.qty > 0 && (run.slot != slot || run.sid != sid))
+        {
+            release(run.slot, run.sid, run.qty, run.notional);
+            run = Run{};
+        }
+        run.slot = slot;
+        run.sid = sid;
+        run.qty += qty;
+        run.notional += reservePrice * static_cast<double>(qty);
+    };
+
+    Run maker, taker;
+    for (const Fill& f : fills)
+    {
+        add(maker, f.makerSessionIndex, f.makerSession, f.quantity, f.makerReservePrice);
+        add(taker, f.takerSessionIndex, f.takerSession, f.quantity, f.takerReservePrice);
+    }
+    if (maker.qty > 0) {
+        release(maker.slot, maker.sid, maker.qty, maker.notional);
+    }
+    if (taker.qty > 0) {
+        release(taker.slot, taker.sid, taker.qty, taker.notional);
+    }
+}
+
+void RiskGate::onExpired(const Order& order)
+{
+    release(order.sessionIndex, order.sessionId, order.quantity,
+            order.reservePrice * static_cast<double>(order.quantity));
+}
+
+void RiskGate::release(uint32_t slot, SessionId sid, uint64_t qty, double notional)
+{
+    if (slot >= sessions_.size()) {
+        return;
+    }
+    SessionRisk& s = sessions_[slot];
+    SpinGuard guard(s.busy);
+    if (s.owner != sid || s.openQty == 0) {
+        return;
+    }
+
+    // give back exactly what the orders reserved; only rounding noise can
+    // be left once the quantity is gone
+    s.openQty -= std::min(qty, s.openQty);
+    s.openNotional -= notional;
+    if (s.openQty == 0 || s.openNotional < 0.0) {
+        s.openNotional = 0.0;
+    }
+}
+
+uint64_t RiskGate::openQuantity(uint32_t slot) const
+{
+    if (slot >= sessions_.size()) {
+        return 0;
+    }
+    SpinGuard guard(sessions_[slot].busy);
+    return sessions_[slot].openQty;
+}
+
+double RiskGate::openNotional(uint32_t slot) const
+{
+    if (slot >= sessions_.size()) {
+        return 0.0;
+    }
+    SpinGuard guard(sessions_[slot].busy);
+    return sessions_[slot].openNotional;
+}
+
 // ===================
 // OrderBook
 // ===================
 
-OrderBook::OrderBook(MatchingEngine* parent)
-  : parentEngine_(parent)
+OrderBook::OrderBook(MatchingEngine* parent, int64_t ticksPerUnit, std::pmr::memory_resource* resource)
+  : resource_(resource)
+  , buyBook(resource)
+  , sellBook(resource)
+  , coldOrders(resource)
+  , freeColdSlots(resource)
+  , ticksPerUnit_(ticksPerUnit)
+  , stopOrders(resource)
+  , parentEngine_(parent)
 {
 }
 
-std::vector<Fill> OrderBook::addOrder(Order&& order)
+void OrderBook::reserve(size_t restingOrders, size_t stopOrderCount)
+{
+    std::lock_guard<std::mutex> lock(bookMutex);
+    coldOrders.reserve(restingOrders);
+    freeColdSlots.reserve(restingOrders);
+    stopOrders.reserve(stopOrderCount);
+}
+
+FillList OrderBook::addOrder(Order&& order)
+{
+    FillList fills(resource_);
+    addOrder(std::move(order), fills);
+    return fills;
+}
+
+void OrderBook::addOrder(Order&& order, FillList& fills)
 {
     std::lock_guard<std::mutex> lock(bookMutex);
 
-    std::vector<Fill> fills;
     if (order.type == OrderType::StopLoss)
     {
-        // store stop order for future triggers
+        // store stop order for future triggers; the book is unchanged
         stopOrders.push_back(std::move(order));
-        return fills;
+        return;
+    }
+
+    // fill-or-kill either trades in full now or not at all
+    if (order.type == OrderType::FillOrKill && !canFillCompletely(order))
+    {
+        if (parentEngine_) {
+            parentEngine_->onOrderExpired(order);
+        }
+        return;
     }
 
-    fills = matchOrder(order);
+    size_t firstFill = fills.size();
+    matchOrder(order, fills);
 
     // if it's a limit order and there's leftover quantity, place it
     if (order.type == OrderType::Limit && order.quantity > 0)
     {
         placeLimitOrder(std::move(order));
     }
+    else if (order.quantity > 0 && parentEngine_)
+    {
+        // unfilled market/IOC remainder is dropped
+        parentEngine_->onOrderExpired(order);
+    }
 
     // update last trade price from any fills
-    for (auto& f : fills)
+    if (fills.size() > firstFill)
     {
-        lastTradePrice = f.price;
+        lastTradePrice = fills.back().price;
     }
 
     // now see if these fills triggered any stop orders
-    auto triggeredFills = checkStopOrders(lastTradePrice);
-    fills.insert(fills.end(), triggeredFills.begin(), triggeredFills.end());
-
-    return fills;
+    checkStopOrders(lastTradePrice, fills);
+    publishTouch();
 }
 
-std::vector<Fill> OrderBook::checkStopOrders(double tradedPrice)
+void OrderBook::checkStopOrders(double tradedPrice, FillList& fills)
 {
-    std::vector<Fill> allFills;
-
     auto it = stopOrders.begin();
     while (it != stopOrders.end())
     {
@@ -72,15 +380,27 @@ std::vector<Fill> OrderBook::checkStopOrders(double tradedPrice)
 
         if (triggered)
         {
-            // convert to a market order
+            // convert to a market order. With a collar it becomes an IOC
+            // bounded pct beyond the stop price, the same reference the risk
+            // gate reserved against, so a gap past the stop can't fill a buy
+            // above what was reserved
             Order triggeredOrder(it->id, it->isBuy, OrderType::Market,
-                                 0.0, 0.0, it->quantity, it->sessionId);
-            auto fills = matchOrder(triggeredOrder);
-            for (auto& f : fills) {
-                lastTradePrice = f.price;
+                                 0.0, 0.0, it->quantity, it->sessionId, it->sessionIndex);
+            if (marketCollarPct_ > 0.0)
+            {
+                triggeredOrder.type = OrderType::ImmediateOrCancel;
+                triggeredOrder.price = it->isBuy ? it->stopPrice * (1.0 + marketCollarPct_)
+                                                 : it->stopPrice * (1.0 - marketCollarPct_);
+            }
+            triggeredOrder.reservePrice = it->reservePrice;
+            size_t firstFill = fills.size();
+            matchOrder(triggeredOrder, fills);
+            if (triggeredOrder.quantity > 0 && parentEngine_) {
+                parentEngine_->onOrderExpired(triggeredOrder);
+            }
+            if (fills.size() > firstFill) {
+                lastTradePrice = fills.back().price;
             }
-            allFills.insert(allFills.end(), fills.begin(), fills.end());
-
             it = stopOrders.erase(it);
         }
         else
@@ -88,13 +408,17 @@ std::vector<Fill> OrderBook::checkStopOrders(double tradedPrice)
             ++it;
         }
     }
-
-    return allFills;
 }
 
-std::vector<Fill> OrderBook::matchOrder(Order& incoming)
+void OrderBook::matchOrder(Order& incoming, FillList& fills)
 {
-    std::vector<Fill> fills;
+    bool bounded = hasLimitPrice(incoming.type);
+    int64_t limitTicks = 0;
+    if (bounded) {
+        limitTicks = toLimitTicks(incoming.price, incoming.isBuy);
+    } else if (incoming.type == OrderType::Market && marketCollarPct_ > 0.0) {
+        bounded = marketBandTicks(incoming.isBuy, limitTicks);
+    }
 
     if (incoming.isBuy)
     {
@@ -102,24 +426,15 @@ std::vector<Fill> OrderBook::matchOrder(Order& incoming)
         while (incoming.quantity > 0 && !sellBook.empty())
         {
             auto bestSellIt = sellBook.begin(); // lowest price
-            double bestSellPrice = bestSellIt->first;
-            if (incoming.type == OrderType::Limit && incoming.price < bestSellPrice) {
+            if (bounded && limitTicks < bestSellIt->first) {
                 break; // no match
             }
             auto& level = bestSellIt->second;
-            while (incoming.quantity > 0 && !level.empty())
+            while (incoming.quantity > 0 && !level.orders.empty())
             {
-                auto& maker = level.front();
-                double matchPrice = maker.price;
-                consumeOrder(incoming, maker, matchPrice, fills);
-                if (maker.quantity == 0) {
-                    level.pop_front();
-                }
-                if (incoming.quantity == 0) {
-                    break;
-                }
+                consumeOrder(incoming, level, fills);
             }
-            if (level.empty()) {
+            if (level.orders.empty()) {
                 sellBook.erase(bestSellIt);
             }
         }
@@ -130,89 +445,220 @@ std::vector<Fill> OrderBook::matchOrder(Order& incoming)
         while (incoming.quantity > 0 && !buyBook.empty())
         {
             auto bestBuyIt = buyBook.begin(); // highest price first
-            double bestBuyPrice = bestBuyIt->first;
-            if (incoming.type == OrderType::Limit && incoming.price > bestBuyPrice) {
+            if (bounded && limitTicks > bestBuyIt->first) {
                 break; // no match
             }
             auto& level = bestBuyIt->second;
-            while (incoming.quantity > 0 && !level.empty())
+            while (incoming.quantity > 0 && !level.orders.empty())
             {
-                auto& maker = level.front();
-                double matchPrice = maker.price;
-                consumeOrder(incoming, maker, matchPrice, fills);
-                if (maker.quantity == 0) {
-                    level.pop_front();
-                }
-                if (incoming.quantity == 0) {
-                    break;
-                }
+                consumeOrder(incoming, level, fills);
             }
-            if (level.empty()) {
+            if (level.orders.empty()) {
                 buyBook.erase(bestBuyIt);
             }
         }
     }
+}
 
-    return fills;
+bool OrderBook::canFillCompletely(const Order& incoming) const
+{
+    // only level totals are read; individual orders are never touched
+    int64_t limitTicks = toLimitTicks(incoming.price, incoming.isBuy);
+    uint64_t available = 0;
+
+    if (incoming.isBuy)
+    {
+        for (auto it = sellBook.begin(); it != sellBook.end() && it->first <= limitTicks; ++it)
+        {
+            available += it->second.totalQty;
+            if (available >= incoming.quantity) {
+                return true;
+            }
+        }
+    }
+    else
+    {
+        for (auto it = buyBook.begin(); it != buyBook.end() && it->first >= limitTicks; ++it)
+        {
+            available += it->second.totalQty;
+            if (available >= incoming.quantity) {
+                return true;
+            }
+        }
+    }
+    return false;
 }
 
-void OrderBook::consumeOrder(Order& taker, Order& maker, double matchPrice, std::vector<Fill>& fills)
+// trade the taker against the order at the front of the level
+void OrderBook::consumeOrder(Order& taker, PriceLevel& level, FillList& fills)
 {
+    RestingOrder& maker = level.orders.front();
     uint64_t traded = std::min(taker.quantity, maker.quantity);
     taker.quantity -= traded;
     maker.quantity -= traded;
+    level.totalQty -= traded;
 
     Fill fill;
     fill.takerOrderId   = taker.id;
     fill.takerSession   = taker.sessionId;
     fill.makerOrderId   = maker.id;
-    fill.makerSession   = maker.sessionId;
-    fill.price          = matchPrice;
+    fill.makerSession   = coldOrders[maker.coldIndex].sessionId;
+    fill.takerSessionIndex = taker.sessionIndex;
+    fill.makerSessionIndex = maker.sessionIndex;
+    fill.price          = toPrice(maker.priceTicks);
     fill.quantity       = traded;
     fill.isBuy          = taker.isBuy; // from the taker's perspective
+    fill.makerReservePrice = coldOrders[maker.coldIndex].reservePrice;
+    fill.takerReservePrice = taker.reservePrice;
 
     fills.push_back(fill);
+
+    if (maker.quantity == 0)
+    {
+        releaseCold(maker.coldIndex);
+        level.orders.pop_front();
+    }
 }
 
 void OrderBook::placeLimitOrder(Order&& order)
 {
-    if (order.isBuy)
+    uint32_t coldIndex;
+    if (!freeColdSlots.empty())
     {
-        auto it = buyBook.find(order.price);
-        if (it == buyBook.end()) {
-            buyBook[order.price] = PriceLevel{};
-            it = buyBook.find(order.price);
-        }
-        it->second.push_back(std::move(order));
+        coldIndex = freeColdSlots.back();
+        freeColdSlots.pop_back();
+        coldOrders[coldIndex] = RestingOrderCold{order.sessionId, order.timestamp, order.reservePrice};
     }
     else
     {
-        auto it = sellBook.find(order.price);
-        if (it == sellBook.end()) {
-            sellBook[order.price] = PriceLevel{};
-            it = sellBook.find(order.price);
+        coldIndex = static_cast<uint32_t>(coldOrders.size());
+        coldOrders.push_back(RestingOrderCold{order.sessionId, order.timestamp, order.reservePrice});
+    }
+
+    RestingOrder resting{order.id, toLimitTicks(order.price, order.isBuy), order.quantity,
+                         order.sessionIndex, coldIndex};
+    PriceLevel& level = order.isBuy ? buyBook[resting.priceTicks] : sellBook[resting.priceTicks];
+    level.orders.push_back(resting);
+    level.totalQty += resting.quantity;
+    ++restingOrders;
+}
+
+void OrderBook::releaseCold(uint32_t coldIndex)
+{
+    freeColdSlots.push_back(coldIndex);
+    --restingOrders;
+}
+
+bool OrderBook::marketBandTicks(bool isBuy, int64_t& bandTicks) const
+{
+    double reference = lastTradePrice.load(std::memory_order_relaxed);
+    if (reference <= 0.0)
+    {
+        // no trade yet: collar around the touch the order would hit first
+        if (isBuy ? sellBook.empty() : buyBook.empty()) {
+            return false;  // nothing to trade against anyway
         }
-        it->second.push_back(std::move(order));
+        reference = toPrice(isBuy ? sellBook.begin()->first : buyBook.begin()->first);
     }
+    bandTicks = isBuy ? toLimitTicks(reference * (1.0 + marketCollarPct_), true)
+                      : toLimitTicks(reference * (1.0 - marketCollarPct_), false);
+    return true;
+}
+
+int64_t OrderBook::toLimitTicks(double price, bool isBuy) const
+{
+    // an off-tick limit must not trade through itself: buys round down to
+    // the tick below, sells up to the tick above. Within float noise of a
+    // tick counts as on it.
+    double scaled = price * static_cast<double>(ticksPerUnit_);
+    double nearest = std::round(scaled);
+    if (std::fabs(scaled - nearest) < 1e-6) {
+        return static_cast<int64_t>(nearest);
+    }
+    return static_cast<int64_t>(isBuy ? std::floor(scaled) : std::ceil(scaled));
+}
+
+void OrderBook::publishTouch()
+{
+    bestBidPrice_.store(buyBook.empty() ? 0.0 : toPrice(buyBook.begin()->first),
+                        std::memory_order_relaxed);
+    bestAskPrice_.store(sellBook.empty() ? 0.0 : toPrice(sellBook.begin()->first),
+                        std::memory_order_relaxed);
+}
+
+size_t OrderBook::restingCount() const
+{
+    std::lock_guard<std::mutex> lock(bookMutex);
+    return restingOrders;
 }
 
 // ===================
 // MatchingEngine
 // ===================
 
-MatchingEngine::MatchingEngine()
-  : book_(this),
-    running_(false)
+namespace
+{
+// Enough arena for the configured capacities, with room for pool slack
+size_t arenaBytesFor(const EngineConfig& config)
+{
+    const MemoryPolicy& m = config.memory;
+    size_t perResting = sizeof(RestingOrder) + sizeof(RestingOrderCold) + sizeof(uint32_t);
+    size_t perLevel = 1024;     // map node, deque map and first deque block
+    size_t bytes = m.maxRestingOrders * perResting * 3 / 2
+                 + m.maxPriceLevels * perLevel
+                 + m.maxStopOrders * sizeof(Order)
+                 + config.maxQueueDepth * sizeof(Order) * 2
+                 + (4 << 20);   // fill lists and pool bookkeeping; the pool
+                                // carves blocks in chunks of a dozen or more
+    return bytes;
+}
+
+// The arena never takes memory back, so anything the pool passes straight
+// upstream is lost when freed. Pool every block the book churns through:
+// level deque blocks and maps, map nodes, and a sweep's fill list.
+std::pmr::pool_options bookPoolOptions()
+{
+    std::pmr::pool_options options;
+    options.largest_required_pool_block = 1 << 20;
+    return options;
+}
+} // namespace
+
+MatchingEngine::MatchingEngine(const EngineConfig& config)
+  : arena_(arenaBytesFor(config), config.memory.pages),
+    bookPool_(bookPoolOptions(), &arena_),
+    lockMemory_(config.memory.lockMemory),
+    book_(this, config.ticksPerUnit, &bookPool_),
+    riskGate_(config.risk),
+    maxQueueDepth_(std::max<size_t>(config.maxQueueDepth, 1)),
+    pauseReadDepth_(std::min(config.pauseReadDepth, maxQueueDepth_)),
+    resumeReadDepth_(std::min(config.resumeReadDepth, pauseReadDepth_)),
+    running_(false),
+    batch_(&arena_),
+    fills_(&bookPool_)
 {
+    book_.setMarketCollar(config.risk.priceCollarPct);
+    book_.reserve(config.memory.maxRestingOrders, config.memory.maxStopOrders);
+    queueSlots_ = static_cast<OrderMsg*>(arena_.allocate(maxQueueDepth_ * sizeof(OrderMsg), alignof(OrderMsg)));
+    batch_.reserve(std::min(maxQueueDepth_, kMaxBatch));
+    fills_.reserve(kInitialFills);
 }
 
 MatchingEngine::~MatchingEngine()
 {
     stop();
+    // OrderMsg is trivially destructible, so the ring slots are simply dropped
+    arena_.deallocate(queueSlots_, maxQueueDepth_ * sizeof(OrderMsg), alignof(OrderMsg));
 }
 
 void MatchingEngine::start()
 {
+    // take the page faults now rather than on the first orders
+    arena_.prefault();
+    if (lockMemory_ && !arena_.lock()) {
+        std::cerr << "mlock of engine memory failed, continuing unlocked" << std::endl;
+    }
+
     running_.store(true);
     matchingThread_ = std::thread([this]{ matchingLoop(); });
 }
@@ -230,55 +676,165 @@ void MatchingEngine::matchingLoop()
 {
     while (running_.load())
     {
-        std::deque<OrderMsg> localQueue;
         {
             std::unique_lock<std::mutex> lock(queueMutex_);
             cv_.wait(lock, [this] {
-                return !running_.load() || !orderQueue_.empty();
+                return !running_.load() || queueCount_ > 0;
             });
-            if (!running_.load() && orderQueue_.empty()) {
+            if (!running_.load() && queueCount_ == 0) {
                 break;
             }
-            localQueue.swap(orderQueue_);
+            // move a batch out of the ring so matching runs without the lock
+            while (queueCount_ > 0 && batch_.size() < batch_.capacity())
+            {
+                batch_.push_back(std::move(queueSlots_[queueHead_]));
+                queueHead_ = (queueHead_ + 1) % maxQueueDepth_;
+                --queueCount_;
+            }
         }
 
         // Process orders
-        while (!localQueue.empty())
+        for (auto& msg : batch_)
         {
-            auto msg = std::move(localQueue.front());
-            localQueue.pop_front();
-
-            std::vector<Fill> fills = book_.addOrder(std::move(msg.order));
-            if (!fills.empty()) {
-                notifyFills(fills);
+            fills_.clear();
+            book_.addOrder(std::move(msg.order), fills_);
+            // seq_cst pairs with whenIngressDrained, so either it sees this
+            // decrement or we see its waiter
+            size_t depth = queueDepth_.fetch_sub(1) - 1;
+            if (depth <= resumeReadDepth_ && drainWaiting_.load()) {
+                wakeDrainWaiters();
+            }
+            if (!fills_.empty()) {
+                riskGate_.onFills(fills_);
+                notifyFills(fills_);
             }
         }
+        batch_.clear();
     }
 }
 
-void MatchingEngine::submitOrder(Order&& order)
+SubmitStatus MatchingEngine::submitOrder(Order&& order)
 {
+    double reference = book_.lastPrice();
+    if (reference <= 0.0 && order.type == OrderType::Market) {
+        reference = order.isBuy ? book_.bestAsk() : book_.bestBid();
+    }
+    SubmitStatus status = riskGate_.check(order, reference);
+    if (status != SubmitStatus::Accepted) {
+        return status;
+    }
+
     {
         std::lock_guard<std::mutex> lock(queueMutex_);
-        orderQueue_.push_back(OrderMsg{std::move(order)});
+        size_t depth = queueDepth_.load(std::memory_order_relaxed);
+        if (depth >= maxQueueDepth_)
+        {
+            rejectedBusy_.fetch_add(1, std::memory_order_relaxed);
+            // hand back the reservation made by the risk check
+            riskGate_.onExpired(order);
+            return SubmitStatus::Busy;
+        }
+        // depth counts queued plus in-progress orders, so the ring has room
+        new (&queueSlots_[(queueHead_ + queueCount_) % maxQueueDepth_]) OrderMsg{std::move(order)};
+        ++queueCount_;
+        // the matcher decrements without the lock, so add rather than store
+        depth = queueDepth_.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (depth > queueHighWater_.load(std::memory_order_relaxed)) {
+            queueHighWater_.store(depth, std::memory_order_relaxed);
+        }
     }
     cv_.notify_one();
+    return SubmitStatus::Accepted;
+}
+
+bool MatchingEngine::ingressCongested() const
+{
+    return queueDepth_.load(std::memory_order_relaxed) >= pauseReadDepth_;
+}
+
+void MatchingEngine::whenIngressDrained(std::function<void()>&& resume)
+{
+    {
+        std::lock_guard<std::mutex> lock(drainMutex_);
+        drainWaiters_.push_back(std::move(resume));
+        drainWaiting_.store(true);
+        // the matcher may have drained the queue before it could see the flag
+        if (queueDepth_.load() > resumeReadDepth_) {
+            return;
+        }
+    }
+    wakeDrainWaiters();
+}
+
+void MatchingEngine::wakeDrainWaiters()
+{
+    std::vector<std::function<void()>> ready;
+    {
+        std::lock_guard<std::mutex> lock(drainMutex_);
+        ready.swap(drainWaiters_);
+        drainWaiting_.store(false);
+    }
+    for (auto& resume : ready) {
+        resume();
+    }
+}
+
+IngressStats MatchingEngine::ingressStats() const
+{
+    IngressStats stats;
+    stats.depth = queueDepth_.load(std::memory_order_relaxed);
+    stats.highWaterMark = queueHighWater_.load(std::memory_order_relaxed);
+    stats.rejectedBusy = rejectedBusy_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void MatchingEngine::resetHighWaterMark()
+{
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    queueHighWater_.store(queueDepth_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+void MatchingEngine::onOrderExpired(const Order& order)
+{
+    riskGate_.onExpired(order);
 }
 
 // session callbacks
-void MatchingEngine::registerSession(SessionId sid, std::function<void(const Fill&)>&& cb)
+uint32_t MatchingEngine::registerSession(SessionId sid, std::function<void(const Fill&)>&& cb)
 {
     std::lock_guard<std::mutex> lock(callbackMutex_);
+    uint32_t slot;
+    auto it = sessionSlots_.find(sid);
+    if (it != sessionSlots_.end())
+    {
+        slot = it->second;
+    }
+    else
+    {
+        // a session without a slot could never trade, so don't keep its callback
+        slot = riskGate_.acquireSlot(sid);
+        if (slot == kNoSessionIndex) {
+            return kNoSessionIndex;
+        }
+        sessionSlots_[sid] = slot;
+    }
     sessionCallbacks_[sid] = std::move(cb);
+    return slot;
 }
 
 void MatchingEngine::unregisterSession(SessionId sid)
 {
     std::lock_guard<std::mutex> lock(callbackMutex_);
     sessionCallbacks_.erase(sid);
+
+    auto it = sessionSlots_.find(sid);
+    if (it != sessionSlots_.end()) {
+        riskGate_.releaseSlot(it->second);
+        sessionSlots_.erase(it);
+    }
 }
 
-void MatchingEngine::notifyFills(const std::vector<Fill>& fills)
+void MatchingEngine::notifyFills(const FillList& fills)
 {
     std::lock_guard<std::mutex> lock(callbackMutex_);
     for (auto& f : fills)
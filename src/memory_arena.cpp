@@ -0,0 +1,181 @@
+#include "memory_arena.hpp"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+namespace MatchingEngine
+{
+
+namespace
+{
+constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+size_t roundUp(size_t n, size_t to)
+{
+    return (n + to - 1) / to * to;
+}
+
+// Map len bytes aligned to a huge page boundary, so THP can back all of it
+char* mapAligned(size_t len)
+{
+    size_t padded = len + kHugePageSize;
+    void* p = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return nullptr;
+    }
+    auto start = reinterpret_cast<uintptr_t>(p);
+    auto aligned = roundUp(start, kHugePageSize);
+    if (aligned > start) {
+        munmap(p, aligned - start);
+    }
+    size_t tail = (start + padded) - (aligned + len);
+    if (tail > 0) {
+        munmap(reinterpret_cast<void*>(aligned + len), tail);
+    }
+    return reinterpret_cast<char*>(aligned);
+}
+
+// madvise(MADV_HUGEPAGE) succeeds even when THP is switched off, so ask the
+// kernel which mode is selected: "always [madvise] never"
+bool transparentHugePagesEnabled()
+{
+    std::ifstream in("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string modes;
+    if (!std::getline(in, modes)) {
+        return false;
+    }
+    return modes.find("[always]") != std::string::npos
+        || modes.find("[madvise]") != std::string::npos;
+}
+} // namespace
+
+const char* toString(PageKind kind)
+{
+    switch (kind)
+    {
+        case PageKind::Normal:      return "normal";
+        case PageKind::Transparent: return "transparent";
+        case PageKind::Explicit:    return "explicit";
+    }
+    return "unknown";
+}
+
+MemoryArena::MemoryArena(size_t bytes, PageKind preferred)
+{
+    if (bytes == 0) {
+        return;
+    }
+    size_ = roundUp(bytes, kHugePageSize);
+
+    if (preferred == PageKind::Explicit)
+    {
+        void* p = mmap(nullptr, size_, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+        {
+            base_ = static_cast<char*>(p);
+            pages_ = PageKind::Explicit;
+            return;
+        }
+        std::cerr << "Explicit huge pages unavailable, falling back" << std::endl;
+    }
+
+    base_ = mapAligned(size_);
+    if (!base_)
+    {
+        std::cerr << "Arena reservation of " << size_ << " bytes failed, using the heap" << std::endl;
+        size_ = 0;
+        return;
+    }
+    if (preferred != PageKind::Normal
+        && madvise(base_, size_, MADV_HUGEPAGE) == 0
+        && transparentHugePagesEnabled()) {
+        pages_ = PageKind::Transparent;
+    }
+}
+
+MemoryArena::~MemoryArena()
+{
+    if (base_) {
+        munmap(base_, size_);
+    }
+}
+
+void MemoryArena::prefault()
+{
+    if (!base_ || prefaulted_) {
+        return;
+    }
+    if (madvise(base_, size_, MADV_POPULATE_WRITE) != 0)
+    {
+        // older kernels: write to each page by hand, preserving contents
+        long pageSize = sysconf(_SC_PAGESIZE);
+        for (size_t off = 0; off < size_; off += static_cast<size_t>(pageSize))
+        {
+            volatile char* p = base_ + off;
+            *p = *p;
+        }
+    }
+    prefaulted_ = true;
+}
+
+bool MemoryArena::lock()
+{
+    if (!base_) {
+        return false;
+    }
+    if (!locked_ && mlock(base_, size_) == 0) {
+        locked_ = true;
+    }
+    return locked_;
+}
+
+MemoryStats MemoryArena::stats() const
+{
+    MemoryStats s;
+    s.reservedBytes = size_;
+    s.usedBytes = used_.load(std::memory_order_relaxed);
+    s.overflowBytes = overflow_.load(std::memory_order_relaxed);
+    s.pages = pages_;
+    s.prefaulted = prefaulted_;
+    s.locked = locked_;
+    return s;
+}
+
+void* MemoryArena::do_allocate(size_t bytes, size_t alignment)
+{
+    // only the allocating thread writes, so load and store rather than a
+    // read-modify-write on the hot path
+    size_t offset = roundUp(used_.load(std::memory_order_relaxed), alignment);
+    if (base_ && offset + bytes <= size_)
+    {
+        used_.store(offset + bytes, std::memory_order_relaxed);
+        return base_ + offset;
+    }
+    overflow_.store(overflow_.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+}
+
+void MemoryArena::do_deallocate(void* p, size_t bytes, size_t alignment)
+{
+    char* c = static_cast<char*>(p);
+    if (base_ && c >= base_ && c < base_ + size_) {
+        return;  // arena memory is only released with the arena
+    }
+    overflow_.store(overflow_.load(std::memory_order_relaxed) - bytes, std::memory_order_relaxed);
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+}
+
+bool MemoryArena::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+    return this == &other;
+}
+
+} // namespace MatchingEngine
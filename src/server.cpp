@@ -1,10 +1,12 @@
 #include "matching_engine.hpp"
+#include "ktls.hpp"
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include <sstream>
 #include <atomic>
 #include <memory>
 #include <iostream>
+#include <type_traits>
 
 using boost::asio::ip::tcp;
 namespace ssl = boost::asio::ssl;
@@ -13,37 +15,59 @@ namespace Server
 {
 static std::atomic<uint64_t> gSessionIdCounter{1};
 
-class Session : public std::enable_shared_from_this<Session>
+// The TCP socket underneath a session's stream
+inline tcp::socket& rawSocket(tcp::socket& stream) { return stream; }
+inline tcp::socket& rawSocket(ssl::stream<tcp::socket>& stream) { return stream.next_layer(); }
+
+// One client connection. Stream is ssl::stream<tcp::socket> for the TLS
+// listener or a bare tcp::socket for the plaintext one.
+template <typename Stream>
+class Session : public std::enable_shared_from_this<Session<Stream>>
 {
+    static constexpr bool kIsTls = !std::is_same<Stream, tcp::socket>::value;
+
 public:
-    Session(tcp::socket socket,
-            ssl::context& sslContext,
-            MatchingEngine::MatchingEngine& engine)
-      : sslStream_(std::move(socket), sslContext)
+    template <typename... StreamArgs>
+    Session(MatchingEngine::MatchingEngine& engine, bool kernelTls, StreamArgs&&... streamArgs)
+      : stream_(std::forward<StreamArgs>(streamArgs)...)
       , engine_(engine)
       , sessionId_(gSessionIdCounter.fetch_add(1))
+      , kernelTlsRequested_(kernelTls)
     {
     }
 
     void start()
     {
         // Register fill callback
-        engine_.registerSession(sessionId_, [weakSelf = weak_from_this()](const MatchingEngine::Fill& fill){
+        sessionIndex_ = engine_.registerSession(sessionId_, [weakSelf = this->weak_from_this()](const MatchingEngine::Fill& fill){
             if (auto self = weakSelf.lock()) {
                 self->onFill(fill);
             }
         });
 
-        // Async SSL handshake
-        auto self(shared_from_this());
-        sslStream_.async_handshake(ssl::stream_base::server,
-            [this, self](const boost::system::error_code& ec){
-                if (!ec) {
-                    doRead();
-                } else {
-                    std::cerr << "Handshake failed: " << ec.message() << std::endl;
-                }
-            });
+        if constexpr (kIsTls)
+        {
+            // Async SSL handshake
+            auto self(this->shared_from_this());
+            stream_.async_handshake(ssl::stream_base::server,
+                [this, self](const boost::system::error_code& ec){
+                    if (ec) {
+                        std::cerr << "Handshake failed: " << ec.message() << std::endl;
+                    } else if (sessionIndex_ == MatchingEngine::kNoSessionIndex) {
+                        rejectAndClose("too-many-sessions");
+                    } else {
+                        onHandshake();
+                    }
+                });
+        }
+        else if (sessionIndex_ == MatchingEngine::kNoSessionIndex)
+        {
+            rejectAndClose("too-many-sessions");
+        }
+        else
+        {
+            doRead();
+        }
     }
 
     void stop()
@@ -51,15 +75,72 @@ public:
         engine_.unregisterSession(sessionId_);
         // Close socket
         boost::system::error_code ignored;
-        sslStream_.lowest_layer().close(ignored);
+        rawSocket(stream_).close(ignored);
+    }
+
+private:
+    void onHandshake()
+    {
+        if constexpr (kIsTls)
+        {
+            if (kernelTlsRequested_)
+            {
+                // from here on the kernel does record crypto and the socket
+                // carries plaintext as far as we are concerned.
+                // Bytes the client sent after its Finished can't be stranded
+                // in asio: ssl::stream only reads the socket when OpenSSL
+                // wants input, which without read-ahead (configureContext)
+                // means the read BIO is drained, and one read is at most a
+                // 17 KiB record while the BIO pair holds 17 KiB. So asio's
+                // own input buffer is always empty here, and anything read
+                // early sits in the BIO or OpenSSL's record buffer, both of
+                // which offload() checks before touching the socket.
+                switch (KernelTls::offload(stream_.native_handle(), rawSocket(stream_).native_handle()))
+                {
+                    case KernelTls::OffloadResult::Offloaded:
+                        kernelTls_ = true;
+                        break;
+                    case KernelTls::OffloadResult::UserSpace:
+                        break;
+                    case KernelTls::OffloadResult::Failed:
+                        std::cerr << "Kernel TLS setup failed" << std::endl;
+                        stop();
+                        return;
+                }
+            }
+        }
+        doRead();
+    }
+
+    // Tell the client why before hanging up, rather than leaving it to find
+    // out from a reject on every order
+    void rejectAndClose(const char* reason)
+    {
+        auto self(this->shared_from_this());
+        auto data = std::make_shared<std::string>(std::string("REJECT ") + reason + "\n");
+        boost::asio::async_write(stream_,
+            boost::asio::buffer(*data),
+            [this, self, data](boost::system::error_code, std::size_t){
+                stop();
+            });
     }
 
 private:
     // Continuously read lines (commands)
     void doRead()
     {
-        auto self(shared_from_this());
-        boost::asio::async_read_until(sslStream_, buffer_, '\n',
+        if (kernelTls_) {
+            readLine(rawSocket(stream_));
+        } else {
+            readLine(stream_);
+        }
+    }
+
+    template <typename S>
+    void readLine(S& s)
+    {
+        auto self(this->shared_from_this());
+        boost::asio::async_read_until(s, buffer_, '\n',
             [this, self](boost::system::error_code ec, std::size_t length){
                 if (!ec) {
                     std::string line(
@@ -69,7 +150,7 @@ private:
                     buffer_.consume(length);
 
                     processLine(line);
-                    doRead();  // read the next command
+                    resumeRead();  // read the next command
                 }
                 else {
                     stop();
@@ -77,10 +158,29 @@ private:
             });
     }
 
+    // Backpressure: while the engine's ingress is congested, leave the
+    // socket unread so TCP flow control pushes back on this client, until
+    // the engine says the queue has drained
+    void resumeRead()
+    {
+        if (!engine_.ingressCongested()) {
+            doRead();
+            return;
+        }
+        // runs on the matching thread, so only hop back to our executor.
+        // With no read pending, the waiter is what keeps the session alive.
+        auto self(this->shared_from_this());
+        engine_.whenIngressDrained([this, self]{
+            boost::asio::post(stream_.get_executor(), [this, self]{ doRead(); });
+        });
+    }
+
     // parse an order command, e.g.:
     // ORDER buy limit 100.0 10
     // ORDER sell stop 101 20
     // ORDER buy market 0 15
+    // ORDER buy ioc 100.0 10   (fill what trades now, cancel the rest)
+    // ORDER sell fok 99.5 40   (fill in full now or cancel)
     void processLine(const std::string& line)
     {
         std::istringstream iss(line);
@@ -90,8 +190,8 @@ private:
         if (cmd == "ORDER")
         {
             std::string sideStr, typeStr;
-            double price;
-            uint64_t qty;
+            double price = 0.0;
+            uint64_t qty = 0;
 
             iss >> sideStr >> typeStr >> price >> qty;
 
@@ -114,6 +214,14 @@ private:
             {
                 ot = MatchingEngine::OrderType::Limit;
             }
+            else if (typeStr == "ioc")
+            {
+                ot = MatchingEngine::OrderType::ImmediateOrCancel;
+            }
+            else if (typeStr == "fok")
+            {
+                ot = MatchingEngine::OrderType::FillOrKill;
+            }
 
             static std::atomic<uint64_t> globalOrderId{1};
             uint64_t thisOrderId = globalOrderId.fetch_add(1);
@@ -126,12 +234,16 @@ private:
                 price,
                 stopP,
                 qty,
-                sessionId_
+                sessionId_,
+                sessionIndex_
             );
-            // Submit to engine
-            engine_.submitOrder(std::move(order));
-
-            writeLine("ORDER ACCEPTED\n");
+            // Submit to engine; risk checks run before it is queued
+            auto status = engine_.submitOrder(std::move(order));
+            if (status == MatchingEngine::SubmitStatus::Accepted) {
+                writeLine("ORDER ACCEPTED\n");
+            } else {
+                writeLine(std::string("REJECT ") + MatchingEngine::toString(status) + "\n");
+            }
         }
         else
         {
@@ -152,12 +264,24 @@ private:
         writeLine(ss.str());
     }
 
-    void writeLine(const std::string& msg)
+    void writeLine(std::string msg)
+    {
+        if (kernelTls_) {
+            writeTo(rawSocket(stream_), std::move(msg));
+        } else {
+            writeTo(stream_, std::move(msg));
+        }
+    }
+
+    template <typename S>
+    void writeTo(S& s, std::string msg)
     {
-        auto self(shared_from_this());
-        boost::asio::async_write(sslStream_,
-            boost::asio::buffer(msg),
-            [this, self](boost::system::error_code ec, std::size_t){
+        // keep the bytes alive until the write completes
+        auto self(this->shared_from_this());
+        auto data = std::make_shared<std::string>(std::move(msg));
+        boost::asio::async_write(s,
+            boost::asio::buffer(*data),
+            [this, self, data](boost::system::error_code ec, std::size_t){
                 if (ec) {
                     stop();
                 }
@@ -165,20 +289,38 @@ private:
     }
 
 private:
-    ssl::stream<tcp::socket> sslStream_;
+    Stream stream_;
     boost::asio::streambuf buffer_;
     MatchingEngine::MatchingEngine& engine_;
     MatchingEngine::SessionId sessionId_;
+    uint32_t sessionIndex_ = MatchingEngine::kNoSessionIndex;
+    bool kernelTlsRequested_;
+    bool kernelTls_ = false;
 };
 
 class Server
 {
 public:
+    // TLS listener; with kernelTls, sessions try to move record crypto into
+    // the kernel after the handshake (the context must be prepared with
+    // KernelTls::configureContext)
     Server(boost::asio::io_context& ioc, unsigned short port,
            ssl::context& sslContext,
-           MatchingEngine::MatchingEngine& engine)
+           MatchingEngine::MatchingEngine& engine,
+           bool kernelTls = false)
       : acceptor_(ioc, tcp::endpoint(tcp::v4(), port))
-      , sslContext_(sslContext)
+      , sslContext_(&sslContext)
+      , engine_(engine)
+      , kernelTls_(kernelTls)
+    {
+        doAccept();
+    }
+
+    // Plaintext listener, for clients on a trusted network only; bound to
+    // a single address rather than every interface
+    Server(boost::asio::io_context& ioc, const boost::asio::ip::address& bindAddress,
+           unsigned short port, MatchingEngine::MatchingEngine& engine)
+      : acceptor_(ioc, tcp::endpoint(bindAddress, port))
       , engine_(engine)
     {
         doAccept();
@@ -190,17 +332,22 @@ private:
         acceptor_.async_accept(
             [this](boost::system::error_code ec, tcp::socket socket){
                 if (!ec) {
-                    auto session = std::make_shared<Session>(
-                        std::move(socket), sslContext_, engine_);
-                    session->start();
+                    if (sslContext_) {
+                        std::make_shared<Session<ssl::stream<tcp::socket>>>(
+                            engine_, kernelTls_, std::move(socket), *sslContext_)->start();
+                    } else {
+                        std::make_shared<Session<tcp::socket>>(
+                            engine_, false, std::move(socket))->start();
+                    }
                 }
                 doAccept();
             });
     }
 
     tcp::acceptor acceptor_;
-    ssl::context& sslContext_;
+    ssl::context* sslContext_ = nullptr;
     MatchingEngine::MatchingEngine& engine_;
+    bool kernelTls_ = false;
 };
 
 } // namespace Server
@@ -1,6 +1,9 @@
 #include <gtest/gtest.h>
 #include "matching_engine.hpp"
+#include "ktls.hpp"
 #include <string>
+#include <vector>
+#include <cmath>
 
 class DummyEngine : public MatchingEngine::MatchingEngine
 {
@@ -8,17 +11,24 @@ public:
     DummyEngine() = default;
 };
 
+// RiskGate::check records the reservation on the order, so hand it a copy
+MatchingEngine::SubmitStatus check(MatchingEngine::RiskGate& gate, MatchingEngine::Order order,
+                                   double referencePrice)
+{
+    return gate.check(order, referencePrice);
+}
+
 TEST(OrderBookTest, LimitOrderMatch)
 {
     DummyEngine dummy;
     MatchingEngine::OrderBook ob(&dummy);
 
-    MatchingEngine::Order buyOrder(1, "Alice", MatchingEngine::OrderType::Limit, true,
+    MatchingEngine::Order buyOrder(1, true, MatchingEngine::OrderType::Limit,
                    100.0, 0.0, 50, 10);
     auto fills1 = ob.addOrder(std::move(buyOrder));
     EXPECT_TRUE(fills1.empty());
 
-    MatchingEngine::Order sellOrder(2, "Bob", MatchingEngine::OrderType::Limit, false,
+    MatchingEngine::Order sellOrder(2, false, MatchingEngine::OrderType::Limit,
                     99.0, 0.0, 50, 20);
     auto fills2 = ob.addOrder(std::move(sellOrder));
 
@@ -34,11 +44,11 @@ TEST(OrderBookTest, PartialFill)
     DummyEngine dummy;
     MatchingEngine::OrderBook ob(&dummy);
 
-    MatchingEngine::Order buyOrder(1, "Alice", MatchingEngine::OrderType::Limit, true,
+    MatchingEngine::Order buyOrder(1, true, MatchingEngine::OrderType::Limit,
                    100.0, 0.0, 100, 10);
     ob.addOrder(std::move(buyOrder));
 
-    MatchingEngine::Order sellOrder(2, "Bob", MatchingEngine::OrderType::Limit, false,
+    MatchingEngine::Order sellOrder(2, false, MatchingEngine::OrderType::Limit,
                     99.0, 0.0, 50, 20);
     auto fills = ob.addOrder(std::move(sellOrder));
     ASSERT_EQ(fills.size(), 1u);
@@ -54,10 +64,10 @@ TEST(OrderBookTest, MarketOrderMatch)
     DummyEngine dummy;
     MatchingEngine::OrderBook ob(&dummy);
 
-    ob.addOrder(MatchingEngine::Order(1, "Bob", MatchingEngine::OrderType::Limit, false,
+    ob.addOrder(MatchingEngine::Order(1, false, MatchingEngine::OrderType::Limit,
                       101.0, 0.0, 50, 20));
 
-    auto fills = ob.addOrder(MatchingEngine::Order(2, "Alice", MatchingEngine::OrderType::Market, true,
+    auto fills = ob.addOrder(MatchingEngine::Order(2, true, MatchingEngine::OrderType::Market,
                                    0.0, 0.0, 20, 10));
     ASSERT_EQ(fills.size(), 1u);
     EXPECT_EQ(fills[0].quantity, 20u);
@@ -71,13 +81,13 @@ TEST(OrderBookTest, StopOrderTrigger)
     DummyEngine dummy;
     MatchingEngine::OrderBook ob(&dummy);
 
-    ob.addOrder(MatchingEngine::Order(1, "Alice", MatchingEngine::OrderType::Limit, true,
+    ob.addOrder(MatchingEngine::Order(1, true, MatchingEngine::OrderType::Limit,
                       100.0, 0.0, 50, 10));
 
-    ob.addOrder(MatchingEngine::Order(2, "Bob", MatchingEngine::OrderType::StopLoss, false,
+    ob.addOrder(MatchingEngine::Order(2, false, MatchingEngine::OrderType::StopLoss,
                       0.0, 101.0, 30, 20));
 
-    auto fills = ob.addOrder(MatchingEngine::Order(3, "Carol", MatchingEngine::OrderType::Limit, false,
+    auto fills = ob.addOrder(MatchingEngine::Order(3, false, MatchingEngine::OrderType::Limit,
                                    100.0, 0.0, 10, 30));
     ASSERT_EQ(fills.size(), 2u);
     EXPECT_EQ(fills[0].price, 100.0);
@@ -89,6 +99,570 @@ TEST(OrderBookTest, StopOrderTrigger)
     EXPECT_TRUE(true);
 }
 
+TEST(OrderBookTest, RestingOrdersKeepColdAttributes)
+{
+    DummyEngine dummy;
+    MatchingEngine::OrderBook ob(&dummy);
+
+    ob.addOrder(MatchingEngine::Order(1, false, MatchingEngine::OrderType::Limit,
+                      100.25, 0.0, 10, 20));
+    ob.addOrder(MatchingEngine::Order(2, false, MatchingEngine::OrderType::Limit,
+                      100.50, 0.0, 10, 21));
+    EXPECT_EQ(ob.restingCount(), 2u);
+    EXPECT_EQ(ob.bestAsk(), 100.25);
+
+    auto fills = ob.addOrder(MatchingEngine::Order(3, true, MatchingEngine::OrderType::Market,
+                                   0.0, 0.0, 15, 30));
+    ASSERT_EQ(fills.size(), 2u);
+    EXPECT_EQ(fills[0].makerSession, 20u);
+    EXPECT_EQ(fills[0].price, 100.25);
+    EXPECT_EQ(fills[1].makerSession, 21u);
+    EXPECT_EQ(fills[1].price, 100.50);
+    EXPECT_EQ(ob.restingCount(), 1u);
+
+    // the freed cold slot is reused by the next resting order
+    ob.addOrder(MatchingEngine::Order(4, false, MatchingEngine::OrderType::Limit,
+                      101.0, 0.0, 5, 22));
+    fills = ob.addOrder(MatchingEngine::Order(5, true, MatchingEngine::OrderType::Limit,
+                              101.0, 0.0, 10, 30));
+    ASSERT_EQ(fills.size(), 2u);
+    EXPECT_EQ(fills[0].makerSession, 21u);
+    EXPECT_EQ(fills[1].makerSession, 22u);
+    EXPECT_EQ(ob.restingCount(), 0u);
+}
+
+TEST(OrderBookTest, OffTickLimitDoesNotTradeThrough)
+{
+    DummyEngine dummy;
+    MatchingEngine::OrderBook ob(&dummy);   // 1e-4 ticks
+
+    ob.addOrder(MatchingEngine::Order(1, false, MatchingEngine::OrderType::Limit,
+                      100.0001, 0.0, 10, 20));
+    auto fills = ob.addOrder(MatchingEngine::Order(2, true, MatchingEngine::OrderType::Limit,
+                                   100.00006, 0.0, 10, 10));
+    EXPECT_TRUE(fills.empty());
+    EXPECT_EQ(ob.bestBid(), 100.0);         // rests at the tick below its limit
+
+    fills = ob.addOrder(MatchingEngine::Order(3, true, MatchingEngine::OrderType::FillOrKill,
+                              100.00006, 0.0, 10, 10));
+    EXPECT_TRUE(fills.empty());
+    fills = ob.addOrder(MatchingEngine::Order(4, true, MatchingEngine::OrderType::ImmediateOrCancel,
+                              100.00006, 0.0, 10, 10));
+    EXPECT_TRUE(fills.empty());
+
+    // a sell limited at 99.99994 rounds up to 100.0 and meets the bid
+    fills = ob.addOrder(MatchingEngine::Order(5, false, MatchingEngine::OrderType::Limit,
+                              99.99994, 0.0, 10, 21));
+    ASSERT_EQ(fills.size(), 1u);
+    EXPECT_EQ(fills[0].price, 100.0);
+}
+
+TEST(OrderBookTest, MarketOrderStopsAtCollar)
+{
+    DummyEngine dummy;
+    MatchingEngine::OrderBook ob(&dummy);
+    ob.setMarketCollar(0.05);
+
+    ob.addOrder(MatchingEngine::Order(1, false, MatchingEngine::OrderType::Limit,
+                      100.0, 0.0, 10, 20));
+    ob.addOrder(MatchingEngine::Order(2, false, MatchingEngine::OrderType::Limit,
+                      104.0, 0.0, 10, 20));
+    ob.addOrder(MatchingEngine::Order(3, false, MatchingEngine::OrderType::Limit,
+                      106.0, 0.0, 10, 20));
+
+    // no trade yet, so the band is 5% around the 100 touch
+    auto fills = ob.addOrder(MatchingEngine::Order(4, true, MatchingEngine::OrderType::Market,
+                                   0.0, 0.0, 1000000, 10));
+    ASSERT_EQ(fills.size(), 2u);
+    EXPECT_EQ(fills[1].price, 104.0);
+    EXPECT_EQ(ob.bestAsk(), 106.0);
+
+    // after trading at 104 the band reaches 109.2
+    fills = ob.addOrder(MatchingEngine::Order(5, true, MatchingEngine::OrderType::Market,
+                              0.0, 0.0, 5, 10));
+    ASSERT_EQ(fills.size(), 1u);
+    EXPECT_EQ(fills[0].price, 106.0);
+}
+
+TEST(OrderBookTest, TriggeredStopBoundedAroundStopPrice)
+{
+    DummyEngine dummy;
+    MatchingEngine::OrderBook ob(&dummy);
+    ob.setMarketCollar(0.05);
+
+    ob.addOrder(MatchingEngine::Order(1, false, MatchingEngine::OrderType::Limit,
+                      103.0, 0.0, 1, 20));
+    ob.addOrder(MatchingEngine::Order(2, false, MatchingEngine::OrderType::Limit,
+                      104.0, 0.0, 5, 20));
+    ob.addOrder(MatchingEngine::Order(3, false, MatchingEngine::OrderType::Limit,
+                      106.0, 0.0, 5, 20));
+    ob.addOrder(MatchingEngine::Order(4, true, MatchingEngine::OrderType::StopLoss,
+                      0.0, 100.0, 10, 10));
+
+    // the trade at 103 gaps past the stop; 5% around the last trade would
+    // reach 108.15, but the stop was reserved at 105 and stops there
+    auto fills = ob.addOrder(MatchingEngine::Order(5, true, MatchingEngine::OrderType::Limit,
+                                   103.0, 0.0, 1, 30));
+    ASSERT_EQ(fills.size(), 2u);
+    EXPECT_EQ(fills[1].takerOrderId, 4u);
+    EXPECT_EQ(fills[1].price, 104.0);
+    EXPECT_EQ(fills[1].quantity, 5u);
+    EXPECT_EQ(ob.bestAsk(), 106.0);
+    EXPECT_EQ(ob.bestBid(), 0.0);
+}
+
+TEST(OrderBookTest, ImmediateOrCancelDropsRemainder)
+{
+    DummyEngine dummy;
+    MatchingEngine::OrderBook ob(&dummy);
+
+    ob.addOrder(MatchingEngine::Order(1, false, MatchingEngine::OrderType::Limit,
+                      100.0, 0.0, 10, 20));
+    ob.addOrder(MatchingEngine::Order(2, false, MatchingEngine::OrderType::Limit,
+                      102.0, 0.0, 10, 20));
+
+    auto fills = ob.addOrder(MatchingEngine::Order(3, true, MatchingEngine::OrderType::ImmediateOrCancel,
+                                   101.0, 0.0, 25, 10));
+    ASSERT_EQ(fills.size(), 1u);
+    EXPECT_EQ(fills[0].quantity, 10u);
+    EXPECT_EQ(ob.bestBid(), 0.0);   // remainder did not rest
+    EXPECT_EQ(ob.bestAsk(), 102.0);
+}
+
+TEST(OrderBookTest, FillOrKill)
+{
+    DummyEngine dummy;
+    MatchingEngine::OrderBook ob(&dummy);
+
+    ob.addOrder(MatchingEngine::Order(1, true, MatchingEngine::OrderType::Limit,
+                      100.0, 0.0, 10, 20));
+    ob.addOrder(MatchingEngine::Order(2, true, MatchingEngine::OrderType::Limit,
+                      100.0, 0.0, 5, 21));
+    ob.addOrder(MatchingEngine::Order(3, true, MatchingEngine::OrderType::Limit,
+                      99.0, 0.0, 10, 22));
+
+    // 25 available at 99 or better, 26 is killed without trading
+    auto fills = ob.addOrder(MatchingEngine::Order(4, false, MatchingEngine::OrderType::FillOrKill,
+                                   99.0, 0.0, 26, 10));
+    EXPECT_TRUE(fills.empty());
+    EXPECT_EQ(ob.restingCount(), 3u);
+
+    // only the 100 level is inside this limit
+    fills = ob.addOrder(MatchingEngine::Order(5, false, MatchingEngine::OrderType::FillOrKill,
+                              100.0, 0.0, 16, 10));
+    EXPECT_TRUE(fills.empty());
+
+    fills = ob.addOrder(MatchingEngine::Order(6, false, MatchingEngine::OrderType::FillOrKill,
+                              99.0, 0.0, 25, 10));
+    ASSERT_EQ(fills.size(), 3u);
+    EXPECT_EQ(ob.restingCount(), 0u);
+    EXPECT_EQ(ob.bestBid(), 0.0);
+}
+
+TEST(RiskGateTest, MaxQuantityAndCollar)
+{
+    MatchingEngine::RiskLimits limits;
+    limits.maxOrderQty = 100;
+    limits.priceCollarPct = 0.05;
+    MatchingEngine::RiskGate gate(limits);
+    uint32_t slot = gate.acquireSlot(7);
+
+    EXPECT_EQ(check(gate, MatchingEngine::Order(1, true, MatchingEngine::OrderType::Limit,
+                                               100.0, 0.0, 101, 7, slot), 100.0),
+              MatchingEngine::SubmitStatus::MaxQuantity);
+    EXPECT_EQ(check(gate, MatchingEngine::Order(2, true, MatchingEngine::OrderType::Limit,
+                                               106.0, 0.0, 10, 7, slot), 100.0),
+              MatchingEngine::SubmitStatus::PriceCollar);
+    EXPECT_EQ(check(gate, MatchingEngine::Order(3, true, MatchingEngine::OrderType::Limit,
+                                               104.0, 0.0, 10, 7, slot), 100.0),
+              MatchingEngine::SubmitStatus::Accepted);
+    EXPECT_EQ(check(gate, MatchingEngine::Order(4, true, MatchingEngine::OrderType::Limit,
+                                               104.0, 0.0, 10, 8, slot), 100.0),
+              MatchingEngine::SubmitStatus::UnknownSession);
+}
+
+TEST(RiskGateTest, RejectsInvalidPrices)
+{
+    MatchingEngine::RiskLimits limits;
+    limits.maxOpenNotional = 1000;
+    MatchingEngine::RiskGate gate(limits);
+    uint32_t slot = gate.acquireSlot(7);
+
+    EXPECT_EQ(check(gate, MatchingEngine::Order(1, false, MatchingEngine::OrderType::Limit,
+                                               -100.0, 0.0, 100, 7, slot), 0.0),
+              MatchingEngine::SubmitStatus::InvalidPrice);
+    EXPECT_EQ(check(gate, MatchingEngine::Order(2, true, MatchingEngine::OrderType::FillOrKill,
+                                               0.0, 0.0, 1, 7, slot), 0.0),
+              MatchingEngine::SubmitStatus::InvalidPrice);
+    EXPECT_EQ(check(gate, MatchingEngine::Order(3, true, MatchingEngine::OrderType::ImmediateOrCancel,
+                                               std::nan(""), 0.0, 1, 7, slot), 0.0),
+              MatchingEngine::SubmitStatus::InvalidPrice);
+    EXPECT_EQ(check(gate, MatchingEngine::Order(4, true, MatchingEngine::OrderType::StopLoss,
+                                               0.0, -5.0, 1, 7, slot), 0.0),
+              MatchingEngine::SubmitStatus::InvalidPrice);
+    EXPECT_EQ(gate.openNotional(slot), 0.0);
+
+    // nothing negative was reserved, so the notional cap still holds
+    EXPECT_EQ(check(gate, MatchingEngine::Order(5, true, MatchingEngine::OrderType::Limit,
+                                               200.0, 0.0, 50, 7, slot), 0.0),
+              MatchingEngine::SubmitStatus::OpenNotional);
+}
+
+TEST(RiskGateTest, MarketOrdersReserveAtBandEdge)
+{
+    MatchingEngine::RiskLimits limits;
+    limits.priceCollarPct = 0.10;
+    limits.maxOpenNotional = 100000;
+    MatchingEngine::RiskGate gate(limits);
+    uint32_t slot = gate.acquireSlot(7);
+
+    EXPECT_EQ(check(gate, MatchingEngine::Order(1, true, MatchingEngine::OrderType::Market,
+                                               0.0, 0.0, 10, 7, slot), 0.0),
+              MatchingEngine::SubmitStatus::NoReferencePrice);
+    EXPECT_EQ(check(gate, MatchingEngine::Order(2, true, MatchingEngine::OrderType::Market,
+                                               0.0, 0.0, 10, 7, slot), 100.0),
+              MatchingEngine::SubmitStatus::Accepted);
+    EXPECT_DOUBLE_EQ(gate.openNotional(slot), 1100.0);
+
+    // a fat-fingered market order is caught by the notional cap
+    EXPECT_EQ(check(gate, MatchingEngine::Order(3, true, MatchingEngine::OrderType::Market,
+                                               0.0, 0.0, 1000, 7, slot), 100.0),
+              MatchingEngine::SubmitStatus::OpenNotional);
+}
+
+TEST(RiskGateTest, OpenQuantityReleasedByFills)
+{
+    MatchingEngine::RiskLimits limits;
+    limits.maxOpenQty = 50;
+    MatchingEngine::RiskGate gate(limits);
+    uint32_t slot = gate.acquireSlot(7);
+
+    EXPECT_EQ(check(gate, MatchingEngine::Order(1, true, MatchingEngine::OrderType::Limit,
+                                               100.0, 0.0, 40, 7, slot), 0.0),
+              MatchingEngine::SubmitStatus::Accepted);
+    EXPECT_EQ(check(gate, MatchingEngine::Order(2, true, MatchingEngine::OrderType::Limit,
+                                               100.0, 0.0, 20, 7, slot), 0.0),
+              MatchingEngine::SubmitStatus::OpenQuantity);
+    EXPECT_EQ(gate.openQuantity(slot), 40u);
+    EXPECT_DOUBLE_EQ(gate.openNotional(slot), 4000.0);
+
+    MatchingEngine::Fill fill{};
+    fill.makerSession = 7;
+    fill.makerSessionIndex = slot;
+    fill.takerSessionIndex = MatchingEngine::kNoSessionIndex;
+    fill.quantity = 30;
+    fill.makerReservePrice = 100.0;
+    gate.onFill(fill);
+    EXPECT_EQ(gate.openQuantity(slot), 10u);
+    EXPECT_DOUBLE_EQ(gate.openNotional(slot), 1000.0);
+
+    EXPECT_EQ(check(gate, MatchingEngine::Order(3, true, MatchingEngine::OrderType::Limit,
+                                               100.0, 0.0, 20, 7, slot), 0.0),
+              MatchingEngine::SubmitStatus::Accepted);
+}
+
+TEST(RiskGateTest, ReleasesExactlyWhatEachOrderReserved)
+{
+    MatchingEngine::RiskLimits limits;
+    limits.maxOpenNotional = 2000;
+    MatchingEngine::RiskGate gate(limits);
+    uint32_t slot = gate.acquireSlot(7);
+
+    MatchingEngine::Order dear(1, true, MatchingEngine::OrderType::Limit, 1000.0, 0.0, 1, 7, slot);
+    MatchingEngine::Order cheap(2, true, MatchingEngine::OrderType::Limit, 1.0, 0.0, 1000, 7, slot);
+    ASSERT_EQ(gate.check(dear, 0.0), MatchingEngine::SubmitStatus::Accepted);
+    ASSERT_EQ(gate.check(cheap, 0.0), MatchingEngine::SubmitStatus::Accepted);
+    EXPECT_DOUBLE_EQ(cheap.reservePrice, 1.0);
+
+    // filling the cheap order must leave the dear one fully reserved,
+    // not release notional at the session's average price
+    MatchingEngine::Fill fill{};
+    fill.makerSession = 7;
+    fill.makerSessionIndex = slot;
+    fill.takerSessionIndex = MatchingEngine::kNoSessionIndex;
+    fill.quantity = 1000;
+    fill.makerReservePrice = cheap.reservePrice;
+    gate.onFill(fill);
+    EXPECT_EQ(gate.openQuantity(slot), 1u);
+    EXPECT_DOUBLE_EQ(gate.openNotional(slot), 1000.0);
+    EXPECT_EQ(check(gate, MatchingEngine::Order(3, true, MatchingEngine::OrderType::Limit,
+                                                1000.0, 0.0, 2, 7, slot), 0.0),
+              MatchingEngine::SubmitStatus::OpenNotional);
+
+    gate.onExpired(dear);
+    EXPECT_EQ(gate.openQuantity(slot), 0u);
+    EXPECT_EQ(gate.openNotional(slot), 0.0);
+}
+
+TEST(OrderBookTest, FillsCarryEachSidesReservation)
+{
+    DummyEngine engine;
+    MatchingEngine::OrderBook ob(&engine);
+
+    MatchingEngine::Order maker(1, false, MatchingEngine::OrderType::Limit, 100.0, 0.0, 10, 1);
+    maker.reservePrice = 100.0;
+    ob.addOrder(std::move(maker));
+
+    MatchingEngine::Order taker(2, true, MatchingEngine::OrderType::Limit, 105.0, 0.0, 4, 2);
+    taker.reservePrice = 105.0;
+    auto fills = ob.addOrder(std::move(taker));
+    ASSERT_EQ(fills.size(), 1u);
+    EXPECT_EQ(fills[0].price, 100.0);
+    EXPECT_EQ(fills[0].makerReservePrice, 100.0);
+    EXPECT_EQ(fills[0].takerReservePrice, 105.0);
+}
+
+TEST(RiskGateTest, RateLimit)
+{
+    MatchingEngine::RiskLimits limits;
+    limits.maxOrdersPerSec = 3;
+    MatchingEngine::RiskGate gate(limits);
+    uint32_t slot = gate.acquireSlot(7);
+
+    MatchingEngine::Order order(1, true, MatchingEngine::OrderType::Limit, 100.0, 0.0, 1, 7, slot);
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(gate.check(order, 0.0), MatchingEngine::SubmitStatus::Accepted);
+    }
+    EXPECT_EQ(gate.check(order, 0.0), MatchingEngine::SubmitStatus::RateLimit);
+
+    order.timestamp += std::chrono::seconds(1);
+    EXPECT_EQ(gate.check(order, 0.0), MatchingEngine::SubmitStatus::Accepted);
+}
+
+TEST(EngineTest, SubmitRejectsUnregisteredSession)
+{
+    MatchingEngine::MatchingEngine engine;
+    EXPECT_EQ(engine.submitOrder(MatchingEngine::Order(1, true, MatchingEngine::OrderType::Limit,
+                                                       100.0, 0.0, 10, 99)),
+              MatchingEngine::SubmitStatus::UnknownSession);
+}
+
+TEST(EngineTest, FullSessionTableRegistersNothing)
+{
+    MatchingEngine::EngineConfig config;
+    config.risk.maxSessions = 1;
+    MatchingEngine::MatchingEngine engine(config);
+
+    int notified = 0;
+    EXPECT_EQ(engine.registerSession(7, [](const MatchingEngine::Fill&){}), 0u);
+    EXPECT_EQ(engine.registerSession(8, [&](const MatchingEngine::Fill&){ ++notified; }),
+              MatchingEngine::kNoSessionIndex);
+
+    MatchingEngine::FillList fills;
+    MatchingEngine::Fill fill{};
+    fill.makerSession = 8;
+    fill.takerSession = 8;
+    fills.push_back(fill);
+    engine.notifyFills(fills);
+    EXPECT_EQ(notified, 0);
+
+    // the slot is reusable once its session goes
+    engine.unregisterSession(7);
+    EXPECT_EQ(engine.registerSession(8, [&](const MatchingEngine::Fill&){ ++notified; }), 0u);
+}
+
+TEST(EngineTest, BoundedIngressRejectsBusy)
+{
+    MatchingEngine::EngineConfig config;
+    config.maxQueueDepth = 2;
+    config.pauseReadDepth = 1;
+    MatchingEngine::MatchingEngine engine(config);  // not started, so nothing drains
+    uint32_t slot = engine.registerSession(7, [](const MatchingEngine::Fill&){});
+
+    EXPECT_FALSE(engine.ingressCongested());
+    for (uint64_t id = 1; id <= 2; ++id) {
+        EXPECT_EQ(engine.submitOrder(MatchingEngine::Order(id, true, MatchingEngine::OrderType::Limit,
+                                                           100.0, 0.0, 10, 7, slot)),
+                  MatchingEngine::SubmitStatus::Accepted);
+    }
+    EXPECT_TRUE(engine.ingressCongested());
+    EXPECT_EQ(engine.submitOrder(MatchingEngine::Order(3, true, MatchingEngine::OrderType::Limit,
+                                                       100.0, 0.0, 10, 7, slot)),
+              MatchingEngine::SubmitStatus::Busy);
+
+    auto stats = engine.ingressStats();
+    EXPECT_EQ(stats.depth, 2u);
+    EXPECT_EQ(stats.highWaterMark, 2u);
+    EXPECT_EQ(stats.rejectedBusy, 1u);
+    // the busy order's reservation was handed back
+    EXPECT_EQ(engine.riskGate().openQuantity(slot), 20u);
+}
+
+TEST(EngineTest, PausedSessionsWokenOnceQueueDrains)
+{
+    MatchingEngine::EngineConfig config;
+    config.maxQueueDepth = 64;
+    config.pauseReadDepth = 32;
+    config.resumeReadDepth = 8;
+    MatchingEngine::MatchingEngine engine(config);
+    uint32_t slot = engine.registerSession(7, [](const MatchingEngine::Fill&){});
+
+    // below the resume depth the callback runs straight away
+    int immediate = 0;
+    engine.whenIngressDrained([&]{ ++immediate; });
+    EXPECT_EQ(immediate, 1);
+
+    for (uint64_t id = 1; id <= 40; ++id) {
+        EXPECT_EQ(engine.submitOrder(MatchingEngine::Order(id, true, MatchingEngine::OrderType::Limit,
+                                                           100.0, 0.0, 1, 7, slot)),
+                  MatchingEngine::SubmitStatus::Accepted);
+    }
+    ASSERT_TRUE(engine.ingressCongested());
+
+    std::atomic<int> woken{0};
+    engine.whenIngressDrained([&]{ ++woken; });
+    EXPECT_EQ(woken.load(), 0);
+
+    engine.start();
+    while (engine.ingressStats().depth > 0) {
+        std::this_thread::yield();
+    }
+    engine.stop();
+    EXPECT_EQ(woken.load(), 1);
+}
+
+TEST(MemoryArenaTest, FallsBackToHeapWhenFull)
+{
+    MatchingEngine::MemoryArena arena(1, MatchingEngine::PageKind::Normal);
+    auto stats = arena.stats();
+    ASSERT_GT(stats.reservedBytes, 0u);
+    EXPECT_EQ(stats.pages, MatchingEngine::PageKind::Normal);
+
+    void* inside = arena.allocate(1024, 64);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(inside) % 64, 0u);
+    void* outside = arena.allocate(stats.reservedBytes, 8);
+    EXPECT_EQ(arena.stats().usedBytes, 1024u);
+    EXPECT_EQ(arena.stats().overflowBytes, stats.reservedBytes);
+
+    arena.deallocate(outside, stats.reservedBytes, 8);
+    arena.deallocate(inside, 1024, 64);
+    EXPECT_EQ(arena.stats().overflowBytes, 0u);
+
+    arena.prefault();
+    EXPECT_TRUE(arena.stats().prefaulted);
+}
+
+TEST(EngineTest, ReservesMemoryUpFront)
+{
+    MatchingEngine::EngineConfig config;
+    config.memory.maxRestingOrders = 1024;
+    config.memory.maxPriceLevels = 64;
+    config.memory.maxStopOrders = 64;
+    config.maxQueueDepth = 128;
+    MatchingEngine::MatchingEngine engine(config);
+
+    auto stats = engine.memoryStats();
+    EXPECT_GT(stats.reservedBytes, 0u);
+    EXPECT_GT(stats.usedBytes, 0u);     // order tables and ingress ring are already carved out
+    EXPECT_EQ(stats.overflowBytes, 0u);
+
+    uint32_t slot = engine.registerSession(7, [](const MatchingEngine::Fill&){});
+    engine.start();
+    EXPECT_TRUE(engine.memoryStats().prefaulted);
+    for (uint64_t id = 1; id <= 300; ++id) {
+        EXPECT_EQ(engine.submitOrder(MatchingEngine::Order(id, true, MatchingEngine::OrderType::Limit,
+                                                           100.0 - (id % 50), 0.0, 1, 7, slot)),
+                  MatchingEngine::SubmitStatus::Accepted);
+        while (engine.ingressStats().depth >= 128) {
+            std::this_thread::yield();
+        }
+    }
+    while (engine.ingressStats().depth > 0) {
+        std::this_thread::yield();
+    }
+    engine.stop();
+    EXPECT_EQ(engine.memoryStats().overflowBytes, 0u);
+}
+
+TEST(EngineTest, RepeatedSweepsReuseArenaMemory)
+{
+    MatchingEngine::EngineConfig config;
+    config.risk.maxOrdersPerSec = 1000000000;
+    MatchingEngine::MatchingEngine engine(config);
+    uint32_t slot = engine.registerSession(7, [](const MatchingEngine::Fill&){});
+    engine.start();
+
+    uint64_t nextId = 1;
+    auto waitIdle = [&] {
+        while (engine.ingressStats().depth > 0) {
+            std::this_thread::yield();
+        }
+    };
+    // rest 2000 one-lot sells, then take them all with one market buy
+    auto sweep = [&] {
+        for (int i = 0; i < 2000; ++i) {
+            ASSERT_EQ(engine.submitOrder(MatchingEngine::Order(nextId++, false, MatchingEngine::OrderType::Limit,
+                                                               100.0, 0.0, 1, 7, slot)),
+                      MatchingEngine::SubmitStatus::Accepted);
+        }
+        waitIdle();
+        ASSERT_EQ(engine.submitOrder(MatchingEngine::Order(nextId++, true, MatchingEngine::OrderType::Market,
+                                                           0.0, 0.0, 2000, 7, slot)),
+                  MatchingEngine::SubmitStatus::Accepted);
+        waitIdle();
+    };
+
+    for (int round = 0; round < 5; ++round) {
+        sweep();
+    }
+    auto warm = engine.memoryStats();
+    for (int round = 0; round < 50; ++round) {
+        sweep();
+    }
+    engine.stop();
+
+    auto after = engine.memoryStats();
+    EXPECT_EQ(after.usedBytes, warm.usedBytes);
+    EXPECT_EQ(after.overflowBytes, 0u);
+    EXPECT_EQ(engine.riskGate().openQuantity(slot), 0u);
+}
+
+std::vector<unsigned char> fromHex(const std::string& hex)
+{
+    std::vector<unsigned char> bytes;
+    for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+        bytes.push_back(static_cast<unsigned char>(std::stoi(hex.substr(i, 2), nullptr, 16)));
+    }
+    return bytes;
+}
+
+// RFC 8448 section 3, server handshake traffic keys
+TEST(KernelTlsTest, ExpandLabelMatchesRfc8448)
+{
+    auto secret = fromHex("b67b7d690cc16c4e75e54213cb2d37b4e9c912bcded9105d42befd59d391ad38");
+    unsigned char key[16];
+    unsigned char iv[12];
+    ASSERT_TRUE(KernelTls::expandLabel(EVP_sha256(), secret.data(), secret.size(), "key", key, sizeof(key)));
+    ASSERT_TRUE(KernelTls::expandLabel(EVP_sha256(), secret.data(), secret.size(), "iv", iv, sizeof(iv)));
+    EXPECT_EQ(std::vector<unsigned char>(key, key + sizeof(key)), fromHex("3fce516009c21727d0f2e4e86ee403bc"));
+    EXPECT_EQ(std::vector<unsigned char>(iv, iv + sizeof(iv)), fromHex("5d313eb2671276ee13000b30"));
+}
+
+// RFC 8448 section 3, application traffic keys as the kernel wants them
+TEST(KernelTlsTest, BuildCryptoInfoSplitsIvIntoSalt)
+{
+    auto server = fromHex("a11af9f05531f856ad47116b45a950328204b4f44bfb6b3a4b4f1f3fcb631643");
+    tls12_crypto_info_aes_gcm_128 info;
+    ASSERT_TRUE(KernelTls::buildCryptoInfo(info, TLS_CIPHER_AES_GCM_128, EVP_sha256(),
+                                           server.data(), server.size()));
+    EXPECT_EQ(info.info.version, TLS_1_3_VERSION);
+    EXPECT_EQ(info.info.cipher_type, TLS_CIPHER_AES_GCM_128);
+    EXPECT_EQ(std::vector<unsigned char>(info.key, info.key + sizeof(info.key)),
+              fromHex("9f02283b6c9c07efc26bb9f2ac92e356"));
+    EXPECT_EQ(std::vector<unsigned char>(info.salt, info.salt + sizeof(info.salt)), fromHex("cf782b88"));
+    EXPECT_EQ(std::vector<unsigned char>(info.iv, info.iv + sizeof(info.iv)), fromHex("dd83549aadf1e984"));
+    EXPECT_EQ(std::vector<unsigned char>(info.rec_seq, info.rec_seq + sizeof(info.rec_seq)),
+              std::vector<unsigned char>(sizeof(info.rec_seq), 0));
+
+    auto client = fromHex("9e40646ce79a7f9dc05af8889bce6552875afa0b06df0087f792ebb7c17504a5");
+    ASSERT_TRUE(KernelTls::buildCryptoInfo(info, TLS_CIPHER_AES_GCM_128, EVP_sha256(),
+                                           client.data(), client.size()));
+    EXPECT_EQ(std::vector<unsigned char>(info.key, info.key + sizeof(info.key)),
+              fromHex("17422dda596ed5d9acd890e3c63f5051"));
+    EXPECT_EQ(std::vector<unsigned char>(info.salt, info.salt + sizeof(info.salt)), fromHex("5b78923d"));
+    EXPECT_EQ(std::vector<unsigned char>(info.iv, info.iv + sizeof(info.iv)), fromHex("ee08579033e523d9"));
+}
+
 int main(int argc, char** argv)
 {
     ::testing::InitGoogleTest(&argc, argv);